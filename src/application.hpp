@@ -5,19 +5,26 @@
 #ifndef SMASHPP_APPLICATION_HPP
 #define SMASHPP_APPLICATION_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <fstream>
 #include <iomanip>  // setw, setprecision
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 #include "container.hpp"
 #include "fcm.hpp"
 #include "file.hpp"
 #include "filter.hpp"
+#include "memplan.hpp"
 #include "naming.hpp"
 #include "output.hpp"
 #include "par.hpp"
+#include "sched.hpp"
 #include "segment.hpp"
 #include "string.hpp"
 #include "time.hpp"
@@ -31,12 +38,29 @@ class application {
 
  private:
   void run(std::unique_ptr<Param>&);
-  auto run_round(std::unique_ptr<Param>&, uint8_t, uint8_t,
-                 std::vector<PosRow>&, uint64_t&) -> uint64_t;
+  void resegment(std::unique_ptr<Param>&);
+  void profile_text(const std::string&) const;
+  void segment_round(std::unique_ptr<Param>&, uint8_t, uint8_t,
+                     const std::string&, uint64_t,
+                     std::vector<std::vector<PosRow>>&, std::atomic<uint64_t>*);
+  void batch_round(std::unique_ptr<Param>&, uint8_t, uint8_t,
+                   const std::string&, uint64_t, uint64_t,
+                   std::vector<std::vector<PosRow>>&, std::atomic<uint64_t>*);
+  auto filter_round(std::unique_ptr<Param>&, uint8_t, uint8_t, Filter&,
+                    std::vector<PosRow>&, uint64_t&) -> uint64_t;
+  void self_compress_round(std::unique_ptr<Param>&, std::unique_ptr<FCM>&,
+                           uint8_t, uint8_t, std::vector<PosRow>&, uint64_t);
+  void set_ir(std::unique_ptr<FCM>&, uint8_t) const;
+  void show_done(const std::string&, uint64_t, const std::string&);
+  void show_mode(uint8_t, uint8_t) const;
 
   void prepare_data(std::unique_ptr<Param>&);
   void remove_temp_seg(std::unique_ptr<Param>&, uint64_t);
   void remove_temp_seq(std::unique_ptr<Param>&);
+
+  ModelPool pool;  // Models reused by the FCMs of all rounds
+  std::unique_ptr<Scheduler> sched;  // Tasks of the segments, on -n threads
+  std::mutex outMut;                 // Progress shown by the tasks
 };
 
 class info {
@@ -75,10 +99,15 @@ void application::exe(int argc, char* argv[]) {
     vizpar->parse(argc, argv);
     auto paint = std::make_unique<VizPaint>();
     paint->plot(vizpar);
+  } else if (has(argv, argv + argc, std::string("-prftxt"))) {
+    const auto opt = std::find(argv, argv + argc, std::string("-prftxt"));
+    if (opt + 1 == argv + argc)
+      error("profile file not specified. Use \"-prftxt <fileName>\".");
+    profile_text(*(opt + 1));
   } else {
     auto par = std::make_unique<Param>();
     par->parse(argc, argv);
-    run(par);
+    par->reseg ? resegment(par) : run(par);
   }
 }
 
@@ -90,10 +119,45 @@ void application::run(std::unique_ptr<Param>& par) {
 
   // FASTA/FASTQ to seq, if applicable
   prepare_data(par);
+  if (par->maxMem != 0) MemPlan(par).fit(par);
+  pool.set_cap(par->poolBytes);
+  sched = std::make_unique<Scheduler>(par->nthr);
+
+  // Round 1. The ref models do not depend on the mode (regular/inverted), so
+  // they are built once and the target is compressed in both modes, in one
+  // pass, while the profile of each is filtered. They are freed before the
+  // segments are compressed ref-free
+  std::vector<std::unique_ptr<FilterStream>> filters;  // Of the modes
+  {
+    par->ID = 0;
+    par->refName = file_name(par->ref);
+    par->tarName = file_name(par->tar);
+    if (par->verbose && par->showInfo) {
+      info{}.show(par);
+      par->showInfo = false;
+    }
+
+    auto models = std::make_unique<FCM>(par, &pool);
+    models->store(par, 1);
+    std::vector<ProfileRing*> rings;
+    for (uint8_t run_num = 0; run_num < 2; ++run_num) {
+      auto task = par->task(par->ref, par->tar);
+      task->ID = run_num;
+      filters.push_back(std::make_unique<FilterStream>(std::move(task), 1));
+      rings.push_back(&filters.back()->ring);
+    }
+    models->compress_both(par, rings);
+    for (auto& f : filters) f->join();
+  }
 
-  // Round 1
   for (uint8_t run_num = 0; run_num < 2; ++run_num) {
-    auto num_seg_round1 = run_round(par, 1, run_num, pos_out, current_pos_row);
+    show_mode(1, run_num);
+    const auto num_seg_round1 = filter_round(
+        par, 1, run_num, filters[run_num]->filter, pos_out, current_pos_row);
+    if (num_seg_round1 != 0) {
+      auto models = std::make_unique<FCM>(par, &pool);
+      self_compress_round(par, models, 1, run_num, pos_out, num_seg_round1);
+    }
 
     // Round 2: old ref = new tar & old tar segments = new refs
     if (num_seg_round1 != 0) {
@@ -106,55 +170,19 @@ void application::run(std::unique_ptr<Param>& par) {
 
       const auto name_seg_round1{
           gen_name(par->ID, ref_round1, tar_round1, Format::segment)};
-      std::string tar_round2 = par->tar = par->ref;
-
-#pragma omp parallel for ordered schedule(static, 1)
-      for (uint64_t i = 0; i < num_seg_round1; ++i) {
-#pragma omp ordered
-        if (!par->verbose)
-          std::cerr << "\r" << par->message << "segment " << i + 1 << " ... ";
-
-        std::string ref_round2 = par->ref = name_seg_round1 + std::to_string(i);
-
-        auto num_seg_round2 =
-            run_round(par, 2, run_num, pos_out, current_pos_row);
-#pragma omp ordered
-        if (par->verbose) std::cerr << '\n';
-
-        if (num_seg_round2 != 0) {
-          // Round 3
-          if (par->deep) {
-#pragma omp ordered
-            if (par->verbose)
-              std::cerr << "    " << italic("Deep compression") << '\n';
-
-            const auto name_seg_round2{
-                gen_name(par->ID, ref_round2, tar_round2, Format::segment)};
-            par->tar = ref_round2;
-
-#pragma omp parallel for ordered schedule(static, 1)
-            for (uint64_t j = 0; j < num_seg_round2; ++j) {
-              par->ref = name_seg_round2 + std::to_string(j);
-              auto num_seg_round3 =
-                  run_round(par, 3, run_num, pos_out, current_pos_row);
-#pragma omp ordered
-              if (par->verbose) std::cerr << "\n";
-              remove_temp_seg(par, num_seg_round3);
-            }
-          }  // Round 3
-
-          par->ref = ref_round2;
-          par->tar = tar_round2;
-          remove_temp_seg(par, num_seg_round2);
-        }
+      std::vector<std::vector<PosRow>> seg_pos;
+      std::atomic<uint64_t> num_done{0};
+      segment_round(par, 2, run_num, name_seg_round1, num_seg_round1, seg_pos,
+                    &num_done);
+      for (const auto& rows : seg_pos) {
+        pos_out.insert(std::end(pos_out), std::begin(rows), std::end(rows));
+        current_pos_row += rows.size();
       }
 
       if (!par->verbose)
         std::cerr << "\r" << par->message << "all segments done.\n\n";
     }  // Round 2
 
-    par->ref = ref_round1;
-    par->tar = tar_round1;
     remove_temp_seg(par, num_seg_round1);
     // remove_temp_seq(par);
   }  // Round 1
@@ -173,47 +201,213 @@ void application::run(std::unique_ptr<Param>& par) {
   }
 }
 
-uint64_t application::run_round(std::unique_ptr<Param>& par, uint8_t round,
-                                uint8_t run_num, std::vector<PosRow>& pos_out,
-                                uint64_t& current_pos_row) {
-  par->ID = run_num;
-  par->refName = file_name(par->ref);
-  par->tarName = file_name(par->tar);
-  auto models = std::make_unique<FCM>(par);
+// A profile saved by -sp (see ProfileWriter) to the output, as the text it
+// was once saved as: an entropy per line, of PREC_PRF significant digits
+void application::profile_text(const std::string& name) const {
+  if (!std::ifstream(name))
+    error("the profile \"" + name + "\" cannot be opened.");
+  ProfileReader prf(name);
+  std::vector<float> block;
+  for (uint64_t beg = 0; beg < prf.info().length; beg += PRF_BLOCK) {
+    prf.read(beg, PRF_BLOCK, block);
+    for (auto e : block) std::cout << precision(PREC_PRF, e) << '\n';
+  }
+}
 
-  if (par->verbose && par->showInfo) {
-    info{}.show(par);
-    par->showInfo = false;
+// Round 1 again, from the profiles of both modes saved by a run with -sp, for
+// all combinations of par's lists. Each profile is read once, then filtered
+// once for each window size and type, as a task, where each filtered value
+// goes to the segments of all thresholds and min. sizes (see SegCut). A
+// summary row per combination goes to the output, and its segments to a file
+// of its own, if -ss
+void application::resegment(std::unique_ptr<Param>& par) {
+  sched = std::make_unique<Scheduler>(par->nthr);
+  std::array<ProfileHeader, 2> headers;
+  std::array<std::vector<float>, 2> profiles;
+  for (uint8_t run_num = 0; run_num != 2; ++run_num) {
+    const auto name{gen_name(run_num, par->ref, par->tar, Format::profile)};
+    if (!std::ifstream(name))
+      error("the profile \"" + name +
+            "\" cannot be opened. It is saved by a run with -sp.");
+    ProfileReader prf(name);
+    headers[run_num] = prf.info();
+    prf.read(0, headers[run_num].length, profiles[run_num]);
   }
-  if (round == 1 && run_num == 0)
-    std::cerr << bold(
-        "====[ REGULAR MODE ]==================================\n");
-  else if (round == 1 && run_num == 1)
-    std::cerr << bold(
-        "====[ INVERTED MODE ]=================================\n");
 
-  // Make all IRs consistent
-  for (auto& ref_model : models->rMs) {
-    ref_model.ir = run_num;
-    if (ref_model.child) ref_model.child->ir = run_num;
+  struct Window {
+    uint32_t size;
+    FilterType type;
+  };
+  std::vector<Window> windows;
+  for (auto size : par->filtSizes)
+    for (auto type : par->filtTypes) windows.push_back(Window{size, type});
+  std::vector<SegCut> cuts;
+  for (auto thresh : par->threshs)
+    for (auto minSize : par->segSizes) cuts.push_back(SegCut{thresh, minSize});
+
+  const auto n = windows.size() * cuts.size();
+  par->message = "[+] Segmenting " + italic(par->tarName) + " by " +
+                 std::to_string(n) + " combination" + (n == 1 ? " " : "s ");
+  std::cerr << par->message << "...";
+  const auto min_ref_tar = std::min(file_size(par->ref), file_size(par->tar));
+  std::vector<std::vector<std::vector<PosRow>>> cut_rows(2 * windows.size());
+  sched->parallel(
+      cut_rows.size(),
+      [&](uint64_t i) { return profiles[i % 2].size(); },
+      [&](uint64_t i) {
+        const uint8_t run_num = i % 2;
+        auto task = par->task(par->ref, par->tar);
+        task->ID = run_num;
+        task->verbose = false;
+        task->saveFilter = task->saveAll = false;
+        task->sampleStep = headers[run_num].sampleStep;
+        task->filt_size = windows[i / 2].size;
+        keep_in_range(1ull, task->filt_size, min_ref_tar / task->sampleStep);
+        task->filt_type = windows[i / 2].type;
+        Filter filter(task);
+        ProfileRing prf(profiles[run_num]);  // A cursor, not a copy
+        filter.smooth_seg(task, 1, prf, cuts, cut_rows[i]);
+      });
+  std::cerr << "\r" << par->message << "done.\n";
+
+  std::cout << "#Thresh\tWSize\tWType\tMinSize\tSegs\tBases\tSegsInv\t"
+               "BasesInv\n";
+  for (size_t w = 0; w != windows.size(); ++w) {
+    par->filt_type = windows[w].type;
+    for (size_t c = 0; c != cuts.size(); ++c) {
+      std::cout << cuts[c].thresh << '\t' << windows[w].size << '\t'
+                << par->print_win_type() << '\t' << cuts[c].minSize;
+      for (uint8_t run_num = 0; run_num != 2; ++run_num) {
+        const auto& rows = cut_rows[2 * w + run_num][c];
+        uint64_t bases{0};
+        for (const auto& row : rows) bases += row.end_pos + 1 - row.beg_pos;
+        std::cout << '\t' << rows.size() << '\t' << bases;
+      }
+      std::cout << '\n';
+
+      if (par->saveSegment || par->saveAll) {
+        std::ofstream seg_file(
+            file_name(par->ref) + "." + file_name(par->tar) + ".th" +
+            precision(PREC_FIL, cuts[c].thresh) + ".f" +
+            std::to_string(windows[w].size) + ".ft" +
+            std::to_string(static_cast<int>(windows[w].type)) + ".m" +
+            std::to_string(cuts[c].minSize) + ".seg");
+        seg_file << "#TBeg\tTEnd\tTRelRdn\tInv\n";
+        for (uint8_t run_num = 0; run_num != 2; ++run_num)
+          for (const auto& row : cut_rows[2 * w + run_num][c])
+            seg_file << (run_num == 0 ? row.beg_pos : row.end_pos) << '\t'
+                     << (run_num == 0 ? row.end_pos : row.beg_pos) << '\t'
+                     << fixed_precision(PREC_POS, row.ent) << '\t'
+                     << (run_num == 0 ? "F" : "T") << '\n';
+      }
+    }
   }
-  for (auto& tar_model : models->tMs) {
-    tar_model.ir = run_num;
-    if (tar_model.child) tar_model.child->ir = run_num;
+}
+
+// Round 2 or 3 of the segments of par's target: each is the ref of a task,
+// whose target is par's ref. The tasks are taken in batches, whose models fit
+// in par->batchBytes, of at most par->nthr, as each has a filter thread (see
+// FilterStream). Their positions are put in seg_pos in order of segments, as
+// if they ran one by one. "num_done", if any, counts the tasks done
+void application::segment_round(std::unique_ptr<Param>& par, uint8_t round,
+                                uint8_t run_num, const std::string& name_seg,
+                                uint64_t nSegs,
+                                std::vector<std::vector<PosRow>>& seg_pos,
+                                std::atomic<uint64_t>* num_done) {
+  seg_pos.assign(nSegs, {});
+  const auto sizes = std::make_unique<FCM>(par, &pool);  // Of the models
+  const auto maxTasks = std::min<uint64_t>(BATCH_TASKS, par->nthr);
+  for (uint64_t beg = 0, end = 0; beg != nSegs; beg = end) {
+    uint64_t bytes = 0;
+    for (; end != nSegs && end - beg != maxTasks; ++end) {
+      bytes +=
+          sizes->model_bytes(par->views->size(name_seg + std::to_string(end)));
+      if (bytes > par->batchBytes && end != beg) break;
+    }
+    batch_round(par, round, run_num, name_seg, beg, end, seg_pos, num_done);
   }
+}
 
-  // Build models and Compress
-  models->store(par, round);
-  models->compress(par, round);
+// The models of the tasks of a batch are built at once, then the target, the
+// same for all, is compressed by all of them in one pass (see
+// FCM::compress_batch), while the profile of each is filtered. Then each task,
+// on its own, segments, and goes on to round 3 after round 2
+void application::batch_round(std::unique_ptr<Param>& par, uint8_t round,
+                              uint8_t run_num, const std::string& name_seg,
+                              uint64_t beg, uint64_t end,
+                              std::vector<std::vector<PosRow>>& seg_pos,
+                              std::atomic<uint64_t>* num_done) {
+  const auto n = end - beg;
+  std::vector<std::unique_ptr<Param>> tasks;
+  std::vector<std::unique_ptr<FCM>> models;
+  for (auto i = beg; i != end; ++i) {
+    tasks.push_back(par->task(name_seg + std::to_string(i), par->ref));
+    tasks.back()->ID = run_num;
+    tasks.back()->nthr = 1;  // The scheduler runs the tasks at once
+    models.push_back(std::make_unique<FCM>(tasks.back(), &pool));
+    set_ir(models.back(), run_num);
+  }
+  const auto cost = [&](uint64_t i) {
+    return par->views->size(tasks[i]->ref);
+  };
 
-  // Filter and segment
-  auto filter = std::make_unique<Filter>(par);
+  sched->parallel(n, cost,
+                  [&](uint64_t i) { models[i]->store(tasks[i], round); });
+  std::vector<std::unique_ptr<FilterStream>> filters;
+  std::vector<ProfileRing*> rings;
+  for (const auto& task : tasks) {
+    filters.push_back(std::make_unique<FilterStream>(
+        task->task(task->ref, task->tar), round));
+    rings.push_back(&filters.back()->ring);
+  }
+  FCM::compress_batch(tasks, models, round, rings, par->nthr);
+  models.clear();  // The models go back to the pool
+  for (auto& f : filters) f->join();
+
+  sched->parallel(n, cost, [&](uint64_t i) {
+    auto& task = tasks[i];
+    auto& pos_out = seg_pos[beg + i];
+    uint64_t current_pos_row = 0;
+    const auto num_seg = filter_round(task, round, run_num, filters[i]->filter,
+                                      pos_out, current_pos_row);
+    if (num_seg != 0) {
+      auto seg_models = std::make_unique<FCM>(task, &pool);
+      self_compress_round(task, seg_models, round, run_num, pos_out, num_seg);
+    }
+    if (par->verbose) std::cerr << '\n';
+
+    // Round 3: old ref = new tar & old tar segments = new refs
+    if (round == 2 && num_seg != 0 && par->deep) {
+      if (par->verbose)
+        std::cerr << "    " << italic("Deep compression") << '\n';
+      std::vector<std::vector<PosRow>> deep_pos;
+      segment_round(task, 3, run_num,
+                    gen_name(task->ID, task->ref, task->tar, Format::segment),
+                    num_seg, deep_pos, nullptr);
+      for (const auto& rows : deep_pos)
+        pos_out.insert(std::end(pos_out), std::begin(rows), std::end(rows));
+    }
+    remove_temp_seg(task, num_seg);
+
+    if (num_done && !par->verbose)
+      show_done(par->message, ++*num_done, " ... ");
+  });
+}
+
+// Segments of the target, by the filter of its profile. Returns no. segments
+uint64_t application::filter_round(std::unique_ptr<Param>& par, uint8_t round,
+                                   uint8_t run_num, Filter& filter,
+                                   std::vector<PosRow>& pos_out,
+                                   uint64_t& current_pos_row) {
+  par->ID = run_num;
+  par->refName = file_name(par->ref);
+  par->tarName = file_name(par->tar);
   // if (!par->manThresh)
   //   par->thresh = static_cast<float>(round_to_prec(models->aveEnt, 0.5));
   //   // par->thresh = static_cast<float>(models->aveEnt);
-  filter->smooth_seg(pos_out, par, round, current_pos_row);
+  filter.add_seg(pos_out, par, round, current_pos_row);
 
-  if (filter->nSegs == 0) {
+  if (filter.nSegs == 0) {
     // if (round == 2) {
     //   pos_out.push_back(
     //       PosRow(0, 0, 0.0, 0.0, run_num, par->ref, par->tar, 0, round));
@@ -221,42 +415,83 @@ uint64_t application::run_round(std::unique_ptr<Param>& par, uint8_t round,
     if (round == 1) std::cerr << '\n';
     return 0;  // continue;
   }
-  filter->extract_seg(pos_out, round, run_num, par->ref);
+  filter.extract_seg(pos_out, par, round, run_num);
+
+  current_pos_row += filter.nSegs;
+  return filter.nSegs;
+}
+
+// Ref-free compression of the segments of a target
+void application::self_compress_round(std::unique_ptr<Param>& par,
+                                      std::unique_ptr<FCM>& models,
+                                      uint8_t round, uint8_t run_num,
+                                      std::vector<PosRow>& pos_out,
+                                      uint64_t nSegs) {
+  par->ID = run_num;
+  set_ir(models, run_num);
 
-  // Ref-free compress
   if (!par->noRedun) {
     if (par->verbose) {
       if (round == 3) std::cerr << "    ";
       std::cerr << "[+] Reference-free compression of the segment"
-                << (filter->nSegs == 1 ? "" : "s") << '\n';
+                << (nSegs == 1 ? "" : "s") << '\n';
     } else {
       if (round == 1) par->message = "[+] Ref-free compression of ";
     }
 
     const auto seg{gen_name(par->ID, par->ref, par->tar, Format::segment)};
-    models->selfEnt.reserve(filter->nSegs);
-#pragma omp parallel for ordered schedule(static, 1)
-    for (uint64_t i = 0; i < filter->nSegs; ++i) {
-#pragma omp ordered
-      {
-        if (!par->verbose && round == 1)
-          std::cerr << "\r" << par->message << "segment " << i + 1 << " ...";
-
-        par->seq = seg + std::to_string(i);
-      }
-      models->self_compress(par, i, round);
-    }
+    models->selfEnt.assign(nSegs, 0);
+    std::atomic<uint64_t> num_done{0};
+    sched->parallel(
+        nSegs,
+        [&](uint64_t i) { return par->views->size(seg + std::to_string(i)); },
+        [&](uint64_t i) {
+          // Own models, as the segments are compressed at once
+          auto task = par->task(par->ref, par->tar);
+          task->seq = seg + std::to_string(i);
+          task->nthr = 1;  // The scheduler runs the segments at once
+          auto seg_models = std::make_unique<FCM>(task, &pool);
+          set_ir(seg_models, run_num);
+          models->selfEnt[i] = seg_models->self_compress(task, i, round);
+          if (!par->verbose && round == 1)
+            show_done(par->message, ++num_done, " ...");
+        });
 
     models->aggregate_slf_ent(pos_out, round, run_num, par->ref, par->noRedun);
     if (!par->verbose && round == 1) {
       std::cerr << "\r" << par->message
-                << (filter->nSegs == 1 ? "the segment " : "all segments ")
+                << (nSegs == 1 ? "the segment " : "all segments ")
                 << "done.         " << '\n';
     }
   }
+}
 
-  current_pos_row += filter->nSegs;
-  return filter->nSegs;
+// Progress of the tasks of a round, which end in any order
+void application::show_done(const std::string& message, uint64_t num_done,
+                            const std::string& dots) {
+  std::lock_guard<std::mutex> lock(outMut);
+  std::cerr << "\r" << message << "segment " << num_done << dots;
+}
+
+void application::set_ir(std::unique_ptr<FCM>& models, uint8_t run_num) const {
+  // Make all IRs consistent
+  for (auto& ref_model : models->rMs) {
+    ref_model.ir = run_num;
+    if (ref_model.child) ref_model.child->ir = run_num;
+  }
+  for (auto& tar_model : models->tMs) {
+    tar_model.ir = run_num;
+    if (tar_model.child) tar_model.child->ir = run_num;
+  }
+}
+
+void application::show_mode(uint8_t round, uint8_t run_num) const {
+  if (round == 1 && run_num == 0)
+    std::cerr << bold(
+        "====[ REGULAR MODE ]==================================\n");
+  else if (round == 1 && run_num == 1)
+    std::cerr << bold(
+        "====[ INVERTED MODE ]=================================\n");
 }
 
 void application::prepare_data(std::unique_ptr<Param>& par) {
@@ -297,10 +532,8 @@ void application::prepare_data(std::unique_ptr<Param>& par) {
 void application::remove_temp_seg(std::unique_ptr<Param>& par,
                                   uint64_t seg_num) {
   const auto seg{gen_name(par->ID, par->ref, par->tar, Format::segment)};
-
   for (uint64_t i = 0; i != seg_num; ++i)
-    if (!par->saveAll && !par->saveSegment)
-      remove((seg + std::to_string(i)).c_str());
+    par->views->remove(seg + std::to_string(i));
 }
 
 void application::remove_temp_seq(std::unique_ptr<Param>& par) {
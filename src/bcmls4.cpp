@@ -0,0 +1,189 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "bcmls4.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+
+#include "exception.hpp"
+using namespace smashpp;
+
+BlockCMLS4::BlockCMLS4(uint64_t w_, uint8_t d_, Pages pages, uint64_t touched)
+    : w(w_), d(d_), tot(0) {
+  init();
+  try {
+    sk.resize(nLines * BLK_LINE, pages, touched);
+  } catch (std::bad_alloc& b) {
+    error("failed memory allocation.");
+  }
+}
+
+BlockCMLS4::BlockCMLS4(uint64_t w_, uint8_t d_, const std::string& name,
+                       uint64_t offset)
+    : w(w_), d(d_), tot(0) {
+  init();  // Seeded, so the same hash functions as when it was built
+  if (!sk.map(name, offset, nLines * BLK_LINE))
+    error("failed loading model \"" + name + "\".");
+}
+
+void BlockCMLS4::init() {
+  if (d == 0 || d > BLK_GROUPS)
+    error("the depth of a blocked sketch must be in [1, " +
+          std::to_string(BLK_GROUPS) + "].");
+  nLines = lines(w, d);
+  if (nLines >> 32u) error("the blocked sketch is too wide.");
+  region = static_cast<uint8_t>(BLK_GROUPS / d);
+
+  constexpr uint64_t seed{0};
+  std::default_random_engine e(seed);
+  std::uniform_int_distribution<uint64_t> uDist(0, (1ull << 63u) - 1);
+  for (size_t i = 0; i != ab.size(); i += 2) {
+    ab[i] = (uDist(e) << 1u) + 1;  // a, odd
+    ab[i + 1] = uDist(e);          // b
+  }
+}
+
+auto BlockCMLS4::lines(uint64_t w, uint8_t d) -> uint64_t {
+  return std::max<uint64_t>(1, (((d * w + 1) >> 1u) + BLK_LINE - 1) / BLK_LINE);
+}
+
+// Top 32 bits of a 2-universal hash, to [0, nLines) by a multiply
+inline uint64_t BlockCMLS4::line(uint64_t row) const {
+  return (((ab[0] * row + ab[1]) >> 32u) * nLines) >> 32u;
+}
+
+// Group of depth i in region i, by double hashing g1 + i g2 of another hash.
+// The next 2 bits of the hash, t, salt the order of symbols in the group, so
+// a context hits its neighbours' counters independently at each depth.
+// pos = byte of the group << 2 | t
+inline void BlockCMLS4::groups(uint64_t row, uint64_t* pos) const {
+  const auto base{line(row) * BLK_LINE};
+  const auto g{ab[2] * row + ab[3]};
+  const auto g1{static_cast<uint32_t>(g >> 32u)};
+  const auto g2{static_cast<uint32_t>(g >> 16u) | 1u};
+  for (uint8_t i = 0; i != d; ++i) {
+    const auto f{static_cast<uint64_t>(g1 + i * g2) * region};
+    pos[i] = ((base + ((i * region + (f >> 32u)) << 1u)) << 2u) |
+             ((f >> 30u) & 3u);
+  }
+}
+
+// Byte, and nibble as an offset of CTR[], of a symbol in a group
+inline uint64_t BlockCMLS4::cell(uint64_t pos, uint8_t sym) {
+  const auto e{(pos ^ sym) & 3u};
+  return (pos >> 2u) + (e >> 1u);
+}
+
+inline uint16_t BlockCMLS4::nibble(uint64_t pos, uint8_t sym) {
+  return static_cast<uint16_t>(((pos ^ sym) & 1u) << 8u);
+}
+
+inline uint8_t BlockCMLS4::min_log_ctr(const uint64_t* pos,
+                                       uint8_t sym) const {
+  uint8_t min{15};  // 15 = max val in CTR[]
+  for (uint8_t i = d; min != 0 && i--;)
+    min = std::min(min, CTR[nibble(pos[i], sym) + sk[cell(pos[i], sym)]]);
+  return min;
+}
+
+void BlockCMLS4::update(BlockCMLS4::ctx_t ctx) {
+  uint64_t pos[BLK_GROUPS];
+  groups(ctx >> 2u, pos);
+  const auto sym{static_cast<uint8_t>(ctx & 3u)};
+  const auto c{min_log_ctr(pos, sym)};
+  if (!(tot++ & POW2minus1[c])) {  // Increase decision
+    for (uint8_t i = d; i--;) {
+      const auto nib{nibble(pos[i], sym)};
+      auto& cellRef = sk[cell(pos[i], sym)];
+      if (CTR[nib + cellRef] == c)  // Conservative
+        cellRef = INC_CTR[nib + cellRef];
+    }
+  }
+}
+
+// As CMLS4::update, by many threads at once
+void BlockCMLS4::update(BlockCMLS4::ctx_t ctx, uint64_t n) {
+  uint64_t pos[BLK_GROUPS];
+  groups(ctx >> 2u, pos);
+  const auto sym{static_cast<uint8_t>(ctx & 3u)};
+  const auto load = [&](uint8_t i) {
+    return CTR[nibble(pos[i], sym) +
+               __atomic_load_n(&sk[cell(pos[i], sym)], __ATOMIC_RELAXED)];
+  };
+
+  uint8_t c{15};
+  for (uint8_t i = d; c != 0 && i--;) c = std::min(c, load(i));
+  if (n & POW2minus1[c]) return;
+
+  for (uint8_t i = d; i--;) {
+    const auto nib{nibble(pos[i], sym)};
+    auto& cellRef = sk[cell(pos[i], sym)];
+    auto byte = __atomic_load_n(&cellRef, __ATOMIC_RELAXED);
+    while (CTR[nib + byte] == c &&
+           !__atomic_compare_exchange_n(&cellRef, &byte, INC_CTR[nib + byte],
+                                        true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+    }
+  }
+}
+
+auto BlockCMLS4::query(BlockCMLS4::ctx_t ctx) const -> BlockCMLS4::val_t {
+  uint64_t pos[BLK_GROUPS];
+  groups(ctx >> 2u, pos);
+  return FREQ2[min_log_ctr(pos, static_cast<uint8_t>(ctx & 3u))];
+}
+
+// The 4 counters of a group are 2 bytes, read at once for all symbols, and
+// put back in symbol order by the salt
+auto BlockCMLS4::query_counters(BlockCMLS4::ctx_t l) const
+    -> std::array<BlockCMLS4::val_t, CARDIN> {
+  uint64_t pos[BLK_GROUPS];
+  groups(l >> 2u, pos);
+  std::array<uint8_t, CARDIN> min{15, 15, 15, 15};
+  for (uint8_t i = d; i--;) {
+    const auto byte{pos[i] >> 2u};
+    const auto t{pos[i] & 3u};
+    const std::array<uint8_t, CARDIN> ctr{
+        CTR[sk[byte]], CTR[256 + sk[byte]], CTR[sk[byte + 1]],
+        CTR[256 + sk[byte + 1]]};
+    for (uint8_t s = 0; s != CARDIN; ++s)
+      min[s] = std::min(min[s], ctr[s ^ t]);
+  }
+  return {FREQ2[min[0]], FREQ2[min[1]], FREQ2[min[2]], FREQ2[min[3]]};
+}
+
+void BlockCMLS4::prefetch(BlockCMLS4::ctx_t ctx) const {
+  sk.prefetch(line(ctx >> 2u) * BLK_LINE);
+}
+
+auto BlockCMLS4::page_size() const -> uint64_t { return sk.page_size(); }
+
+auto BlockCMLS4::is_sparse() const -> bool { return sk.is_sparse(); }
+
+auto BlockCMLS4::held() const -> uint64_t { return sk.bytes(); }
+
+void BlockCMLS4::clear() {
+  sk.clear();
+  tot = 0;
+}
+
+void BlockCMLS4::fit(Pages pages, uint64_t touched) {
+  if (sk.fits(touched)) return;
+  try {
+    sk.resize(sk.size(), pages, touched);
+  } catch (std::bad_alloc& b) {
+    error("failed memory allocation.");
+  }
+}
+
+auto BlockCMLS4::bytes(uint64_t w, uint8_t d, uint64_t touched) -> uint64_t {
+  return Storage<uint8_t>::bytes_for(lines(w, d) * BLK_LINE, touched);
+}
+
+void BlockCMLS4::dump(std::ofstream& ofs) const {
+  ofs.write(reinterpret_cast<const char*>(sk.data()),
+            static_cast<std::streamsize>(sk.size()));
+}
@@ -0,0 +1,74 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_BCMLS4_HPP
+#define SMASHPP_BCMLS4_HPP
+
+#include "cmls4.hpp"
+
+namespace smashpp {
+static constexpr uint64_t BLK_LINE{64};  // Bytes of a block, a cache line
+static constexpr uint8_t BLK_GROUPS{BLK_LINE / 2};  // 4 counters each
+
+// Count-min-log sketch, 4 bits per counter, as CMLS4, of the same memory for
+// a w and d, but blocked: the counters of a context for all d depths, and
+// those of its 3 siblings (the same context, the other symbols), are in one
+// 64-byte line, picked by one hash. The line is split in d regions, one per
+// depth, of BLK_GROUPS/d groups of 4 counters; a sub-hash picks the group of
+// the context in each. So query_counters reads one line, where CMLS4 reads
+// 4d cells all over the sketch. In each group, 2 bits of the sub-hash permute
+// the symbols, so contexts that share a line do not also share a symbol's
+// counter at all depths.
+//
+// Per depth, the counters are as many, and as loaded, as those of CMLS4, so
+// the count-min bound, estimate <= count + eps N, eps = e/w, holds per depth
+// as well. But the depths are not independent: contexts that share a line
+// share it at all depths, so the bound on the error probability, e^-d for
+// CMLS4, is looser, and estimates are a little higher, the more so the
+// fuller the sketch
+class BlockCMLS4 {
+  using ctx_t = uint64_t;
+  using val_t = uint16_t;
+
+ private:
+  uint64_t w;                // Width of sketch, as of CMLS4
+  uint8_t d;                 // Depth of sketch
+  uint64_t nLines;           // Blocks of the sketch
+  uint8_t region;            // Groups of a depth, in a line
+  std::array<uint64_t, 4> ab;  // a, b of the hash of lines and of groups
+  Storage<uint8_t> sk;       // Sketch
+  uint64_t tot;              // Total # elements, so far
+
+ public:
+  BlockCMLS4()
+      : w(W), d(D), nLines(0), region(0), ab{}, tot(0) {}
+  BlockCMLS4(uint64_t, uint8_t, Pages = Pages::transparent, uint64_t = 0);
+  BlockCMLS4(uint64_t, uint8_t, const std::string&, uint64_t);  // Map file
+  void update(ctx_t);                // Update sketch
+  void update(ctx_t, uint64_t);      // Concurrent update, n-th element
+  auto query(ctx_t) const -> val_t;  // Query count of ctx
+  auto query_counters(ctx_t) const -> std::array<val_t, CARDIN>;
+  void prefetch(ctx_t) const;  // Hint that the line of ctx is read soon
+  auto page_size() const -> uint64_t;  // Pages of the sketch (bytes)
+  auto is_sparse() const -> bool;      // See Storage
+  void clear();                        // Zero the counters, for reuse
+  auto held() const -> uint64_t;       // Bytes taken, as it is
+  void fit(Pages, uint64_t);  // Sparse or not as if new, for n touched
+  static auto lines(uint64_t, uint8_t) -> uint64_t;  // Blocks, for w, d
+  static auto bytes(uint64_t, uint8_t, uint64_t)
+      -> uint64_t;  // If new, w, d, touched
+  void dump(std::ofstream&) const;  // Write counters into model file
+
+ private:
+  void init();  // Lines, regions and hash fns, of w and d
+  auto line(uint64_t) const -> uint64_t;  // Of a row: context, no symbol
+  void groups(uint64_t, uint64_t*) const;  // Group and salt, per depth
+  static auto cell(uint64_t, uint8_t) -> uint64_t;     // Byte of a symbol
+  static auto nibble(uint64_t, uint8_t) -> uint16_t;   // Its half, in CTR[]
+  auto min_log_ctr(const uint64_t*, uint8_t) const
+      -> uint8_t;  // Min log val of a symbol in the groups
+};
+}  // namespace smashpp
+
+#endif  // SMASHPP_BCMLS4_HPP
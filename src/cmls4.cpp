@@ -4,18 +4,23 @@
 
 #include "cmls4.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <random>
 #include <array>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "exception.hpp"
 using namespace smashpp;
 
 // W=[e/eps].      0 < eps:   error factor      < 1
 // D=[ln 1/delta]. 0 < delta: error probability < 1
-CMLS4::CMLS4(uint64_t w_, uint8_t d_) : w(w_), d(d_), tot(0) {
+CMLS4::CMLS4(uint64_t w_, uint8_t d_, Pages pages, uint64_t touched)
+    : w(w_), d(d_), tot(0) {
   try {
-    sk.resize((d * w + 1) >> 1u);
+    sk.resize((d * w + 1) >> 1u, pages, touched);
   } catch (std::bad_alloc& b) {
     error("failed memory allocation.");
   }
@@ -24,6 +29,15 @@ CMLS4::CMLS4(uint64_t w_, uint8_t d_) : w(w_), d(d_), tot(0) {
   set_a_b();
 }
 
+CMLS4::CMLS4(uint64_t w_, uint8_t d_, const std::string& name, uint64_t offset)
+    : w(w_), d(d_), tot(0) {
+  if (!sk.map(name, offset, (d * w + 1) >> 1u))
+    error("failed loading model \"" + name + "\".");
+  uhashShift = static_cast<uint8_t>(G - std::floor(std::log2(w)));
+  ab.resize(d << 1u);
+  set_a_b();  // Seeded, so the same hash functions as when it was built
+}
+
 void CMLS4::set_a_b() {
   constexpr uint64_t seed{0};
   std::default_random_engine e(seed);
@@ -38,21 +52,55 @@ void CMLS4::set_a_b() {
 }
 
 void CMLS4::update(CMLS4::ctx_t ctx) {
-  const auto c{min_log_ctr(ctx)};
+  uint64_t h[MAX_HASHES];
+  hash(ctx, h);
+  const auto c{min_log_ctr(h, 0)};
   if (!(tot++ & POW2minus1[c]))  // Increase decision.  x % 2^n = x & (2^n-1)
     // for (uint8_t i=0; i!=d; ++i) {
     for (uint8_t i = d; i--;) {
-      const auto idx = hash(i, ctx);
+      const auto idx = cell(h, i, 0);
       if (read_cell(idx) == c)  // Conservative update
         sk[idx >> 1u] = INC_CTR[((idx & 1ull) << 8u) + sk[idx >> 1u]];
     }
 }
 
-uint8_t CMLS4::min_log_ctr(uint64_t ctx) const {
+// Can be called by many threads at once. Each of them feeds a part of the
+// sequence and passes the rank "n" of the element, in place of "tot". Cells
+// are shared by all contexts, so the outcome is approximate: when two threads
+// hit a cell at about the same time, the order of the updates -- and thus the
+// conservative-update and increase decisions -- may differ from a one-thread
+// build. Every cell stays a valid log counter and no update is torn.
+void CMLS4::update(CMLS4::ctx_t ctx, uint64_t n) {
+  uint64_t h[MAX_HASHES];
+  hash(ctx, h);
+  const auto load = [&](uint64_t idx) {
+    return CTR[((idx & 1ull) << 8u) +
+               __atomic_load_n(&sk[idx >> 1u], __ATOMIC_RELAXED)];
+  };
+
+  uint8_t c{15};
+  for (uint8_t i = d; c != 0 && i--;) c = std::min(c, load(cell(h, i, 0)));
+  if (n & POW2minus1[c]) return;
+
+  for (uint8_t i = d; i--;) {
+    const auto idx = cell(h, i, 0);
+    const auto nib = (idx & 1ull) << 8u;
+    auto byte = __atomic_load_n(&sk[idx >> 1u], __ATOMIC_RELAXED);
+    while (CTR[nib + byte] == c &&
+           !__atomic_compare_exchange_n(&sk[idx >> 1u], &byte,
+                                        INC_CTR[nib + byte], true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+  }
+}
+
+// Of the context x+s, whose x's a*x+b are in h. The hashes of the 4 symbols
+// of a context are 1 multiply: a(x+s)+b = (ax+b) + sa, for x = l, s < 4
+uint8_t CMLS4::min_log_ctr(const uint64_t* h, uint8_t s) const {
   uint8_t min{15};  // 15 = max val in CTR[]
   //  for (uint8_t i=0; i!=d && min!=0; ++i) {
   for (uint8_t i = d; min != 0 && i--;) {
-    const auto lg = read_cell(hash(i, ctx));
+    const auto lg = read_cell(cell(h, i, s));
     if (lg < min) min = lg;
   }
   return min;
@@ -63,30 +111,119 @@ uint8_t CMLS4::read_cell(uint64_t idx) const {
   ////  return CTR[static_cast<uint16_t>(((idx&1ull)<<8u) | sk[idx>>1u])];
 }
 
+// h[i] = a_i x + b_i, of all depths
+void CMLS4::hash(uint64_t x, uint64_t* h) const {
+  for (uint8_t i = 0; i != d; ++i)
+    h[i] = ab[i << 1u] * x + ab[(i << 1u) + 1];
+}
+
 // Strong 2-universal
-uint64_t CMLS4::hash(uint8_t i, uint64_t ctx) const {
-  return i * w + ((ab[i << 1u] * ctx + ab[(i << 1u) + 1]) >> uhashShift);
+uint64_t CMLS4::cell(const uint64_t* h, uint8_t i, uint8_t s) const {
+  return i * w + ((h[i] + s * ab[i << 1u]) >> uhashShift);
 }
 
 auto CMLS4::query(CMLS4::ctx_t ctx) const -> CMLS4::val_t {
-  return FREQ2[min_log_ctr(ctx)];  // Base 2. otherwise (b^c-1)/(b-1)
+  uint64_t h[MAX_HASHES];
+  hash(ctx, h);
+  return FREQ2[min_log_ctr(h, 0)];  // Base 2. otherwise (b^c-1)/(b-1)
 }
 
+// The 4d cells are prefetched first, so that their misses overlap, where
+// the early exits of min_log_ctr would make them one after another. With
+// AVX2, a dense sketch of GATHER_BYTES at most is read by gathers instead
+// (see min_log_ctrs). A larger one is not: its cells miss the cache, and the
+// scalar reads, which stop at the first 0 of each symbol, wait on fewer
 auto CMLS4::query_counters(CMLS4::ctx_t l) const
     -> std::array<CMLS4::val_t, CARDIN> {
-  return {query(l), query(l | 1ull), query(l | 2ull), query(l | 3ull)};
+  uint64_t h[MAX_HASHES];
+  hash(l, h);
+#if defined(__AVX2__)
+  if (!sk.is_sparse() && sk.size() <= GATHER_BYTES) return min_log_ctrs(h);
+#endif
+  for (uint8_t i = d; i--;)
+    for (uint8_t s = 0; s != CARDIN; ++s) sk.prefetch(cell(h, i, s) >> 1u);
+  return {FREQ2[min_log_ctr(h, 0)], FREQ2[min_log_ctr(h, 1)],
+          FREQ2[min_log_ctr(h, 2)], FREQ2[min_log_ctr(h, 3)]};
 }
 
-#ifdef DEBUG
-void CMLS4::dump(std::ofstream& ofs) const {
-  ofs.write((const char*)&sk[0], sk.size());
-  //  ofs.close();
+#if defined(__AVX2__)
+// The 4 symbols are the lanes of a vector, so the cells of a depth are
+// hashed, gathered and min'd in registers at once. A cell is read in the
+// aligned 32-bit word that holds its byte, which lies in the page of the
+// byte, so never out of the mapped memory. Its nibble is the high one if the
+// cell is even, as CTR
+auto CMLS4::min_log_ctrs(const uint64_t* h) const
+    -> std::array<CMLS4::val_t, CARDIN> {
+  const auto addr{reinterpret_cast<uintptr_t>(sk.data())};
+  const auto words{reinterpret_cast<const int*>(addr & ~uintptr_t{3})};
+  const auto lead{static_cast<long long>(addr & 3u)};  // Bytes before ptr
+  const auto shift{_mm_cvtsi32_si128(uhashShift)};
+  alignas(32) uint64_t min[CARDIN];
+  const auto one{_mm256_set1_epi64x(1)}, three{_mm256_set1_epi64x(3)};
+  auto lo{_mm256_set1_epi64x(15)};  // 15 = max val in CTR[]
+  for (uint8_t i = 0; i != d; ++i) {
+    const auto x{h[i]}, a{ab[i << 1u]};  // a(x+s)+b = (ax+b) + sa
+    const auto hs{_mm256_set_epi64x(static_cast<long long>(x + 3 * a),
+                                    static_cast<long long>(x + 2 * a),
+                                    static_cast<long long>(x + a),
+                                    static_cast<long long>(x))};
+    const auto row{_mm256_set1_epi64x(static_cast<long long>(i * w))};
+    const auto idx{_mm256_add_epi64(_mm256_srl_epi64(hs, shift), row)};
+    const auto byte{_mm256_add_epi64(_mm256_srli_epi64(idx, 1),
+                                     _mm256_set1_epi64x(lead))};
+    const auto word{_mm256_i64gather_epi32(
+        words, _mm256_andnot_si256(three, byte), 1)};
+    const auto bits{_mm256_add_epi64(
+        _mm256_slli_epi64(_mm256_and_si256(byte, three), 3),
+        _mm256_slli_epi64(_mm256_andnot_si256(idx, one), 2))};
+    lo = _mm256_min_epu32(  // The upper halves are 0
+        lo, _mm256_and_si256(
+                _mm256_srlv_epi64(_mm256_cvtepu32_epi64(word), bits),
+                _mm256_set1_epi64x(15)));
+    if (_mm256_testz_si256(lo, lo)) break;  // All 0, as min_log_ctr
+  }
+  _mm256_store_si256(reinterpret_cast<__m256i*>(min), lo);
+  return {FREQ2[min[0]], FREQ2[min[1]], FREQ2[min[2]], FREQ2[min[3]]};
 }
+#endif
 
-void CMLS4::load(std::ifstream& ifs) const {
-  ifs.read((char*)&sk[0], sk.size());
+void CMLS4::prefetch(CMLS4::ctx_t ctx) const {
+  uint64_t h[MAX_HASHES];
+  hash(ctx, h);
+  for (uint8_t i = d; i--;) sk.prefetch(cell(h, i, 0) >> 1u);
 }
 
+auto CMLS4::page_size() const -> uint64_t { return sk.page_size(); }
+
+auto CMLS4::is_sparse() const -> bool { return sk.is_sparse(); }
+
+auto CMLS4::held() const -> uint64_t { return sk.bytes(); }
+
+void CMLS4::clear() {
+  sk.clear();
+  tot = 0;
+}
+
+void CMLS4::fit(Pages pages, uint64_t touched) {
+  if (sk.fits(touched)) return;
+  try {
+    sk.resize(sk.size(), pages, touched);
+  } catch (std::bad_alloc& b) {
+    error("failed memory allocation.");
+  }
+}
+
+auto CMLS4::bytes(uint64_t w, uint8_t d, uint64_t touched) -> uint64_t {
+  return Storage<uint8_t>::bytes_for((d * w + 1) >> 1u, touched);
+}
+
+void CMLS4::dump(std::ofstream& ofs) const {
+  ofs.write(reinterpret_cast<const char*>(sk.data()),
+            static_cast<std::streamsize>(sk.size()));
+}
+
+#ifdef DEBUG
+
 uint64_t CMLS4::get_total() const { return tot; }
 
 uint64_t CMLS4::count_empty() const {
@@ -6,9 +6,12 @@
 #define SMASHPP_CMLS4_HPP
 
 #include "par.hpp"
+#include "storage.hpp"
 
 namespace smashpp {
 static constexpr uint32_t G{64};  // Machine word size-univers hash fn
+static constexpr uint16_t MAX_HASHES{256};  // Of a context, d < 256
+static constexpr uint64_t GATHER_BYTES{1ull << 23};  // Sketch, see .cpp
 
 class CMLS4 {  // Count-min-log sketch, 4 bits per counter
   using ctx_t = uint64_t;
@@ -19,19 +22,28 @@ class CMLS4 {  // Count-min-log sketch, 4 bits per counter
   uint8_t d;                 // Depth of sketch
   uint8_t uhashShift;        // Universal hash shift(G-M). (a*x+b)>>(G-M)
   std::vector<uint64_t> ab;  // Coefficients of hash functions
-  std::vector<uint8_t> sk;   // Sketch
+  Storage<uint8_t> sk;       // Sketch
   uint64_t tot;              // Total # elements, so far
 
  public:
   CMLS4() : w(W), d(D), uhashShift(0), tot(0) {}
-  CMLS4(uint64_t, uint8_t);
+  CMLS4(uint64_t, uint8_t, Pages = Pages::transparent, uint64_t = 0);
+  CMLS4(uint64_t, uint8_t, const std::string&, uint64_t);  // Map model file
   void update(ctx_t);                   // Update sketch
+  void update(ctx_t, uint64_t);         // Concurrent update, n-th element
   auto query(ctx_t) const -> val_t;  // Query count of ctx
   auto query_counters(ctx_t) const -> std::array<val_t, CARDIN>;
+  void prefetch(ctx_t) const;  // Hint that the cells of ctx are read soon
+  auto page_size() const -> uint64_t;  // Pages of the sketch (bytes)
+  auto is_sparse() const -> bool;      // See Storage
+  void clear();                        // Zero the counters, for reuse
+  auto held() const -> uint64_t;       // Bytes taken, as it is
+  void fit(Pages, uint64_t);  // Sparse or not as if new, for n touched
+  static auto bytes(uint64_t, uint8_t, uint64_t)
+      -> uint64_t;  // If new, w, d, touched
+  void dump(std::ofstream&) const;      // Write counters into model file
 
 #ifdef DEBUG
-  void dump(std::ofstream&) const;
-  void load(std::ifstream&) const;
   auto get_total() const -> uint64_t;    // Total no. of all items in the sketch
   auto count_empty() const -> uint64_t;  // Number of empty cells in the sketch
   auto max_sk_val() const -> uint8_t;
@@ -41,10 +53,15 @@ class CMLS4 {  // Count-min-log sketch, 4 bits per counter
  private:
   auto read_cell(uint64_t) const -> uint8_t;  // Read each cell of the sketch
   void set_a_b();  // Set coeffs a, b of hash fns (a*x+b) %P %w
-  auto hash(uint8_t, uint64_t) const
+  void hash(uint64_t, uint64_t*) const;  // a*x+b of all depths, at once
+  auto cell(const uint64_t*, uint8_t, uint8_t) const
       -> uint64_t;  // MUST provide pairwise independence
-  auto min_log_ctr(uint64_t) const
+  auto min_log_ctr(const uint64_t*, uint8_t) const
       -> uint8_t;  // Find min log val in the sketch
+#if defined(__AVX2__)
+  auto min_log_ctrs(const uint64_t*) const
+      -> std::array<val_t, CARDIN>;  // Of the 4 symbols, dense sketch
+#endif
 
 #ifdef DEBUG
   void printAB() const;
@@ -41,8 +41,12 @@ enum class Container {  // Data structure
   table_64,
   table_32,
   log_table_8,
-  sketch_8
+  sketch_8,
+  block_sketch_8,  // Sketch, a context's counters in one cache line
+  hash_table_16,   // Exact counts of the contexts seen, in a hash table
+  table_16         // Table, the 4 counters of a context in a word
 };
+static constexpr size_t CONT_KINDS{7};  // Kinds of Container
 enum class FilterType {  // Types of windowing function
   rectangular,
   hamming,
@@ -55,6 +59,7 @@ enum class FilterType {  // Types of windowing function
 };
 enum class Format { profile, filter, position, midposition, segment, self };
 enum class FileType { seq, fasta, fastq };
+enum class Pages { normal, transparent, huge };  // Memory pages of models
 enum class FilterScale { s, m, l };
 enum class Problem { warning, error };
 enum class Align { left, right, internal };
@@ -4,6 +4,8 @@
 
 #include "fcm.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <fstream>
 #include <numeric>  // std::accumulate
@@ -16,34 +18,45 @@
 #include "file.hpp"
 #include "naming.hpp"
 #include "number.hpp"
+#include "packseq.hpp"
 #include "par.hpp"
 using namespace smashpp;
 
-FCM::FCM(std::unique_ptr<Param>& par)
+FCM::FCM(std::unique_ptr<Param>& par, ModelPool* pool_)
     : aveEnt(static_cast<prc_t>(0)),
       rMs(par->refMs),
       tarSegID(0),
+      pool(pool_),
+      held(nullptr),
       entropyN(par->entropyN) {
-  set_cont(rMs);
+  if (par->maxMem == 0) set_cont(par, rMs);  // Else set by MemPlan
   rTMsSize = 0;
   for (const auto& e : rMs)
     if (e.child) ++rTMsSize;
 
   tMs = par->tarMs;
-  set_cont(tMs);
+  if (par->maxMem == 0) set_cont(par, tMs);
   tTMsSize = 0;
   for (const auto& e : tMs)
     if (e.child) ++tTMsSize;
 
-  alloc_model();
+  // The history of a tolerant model changes as it compresses; those of par
+  // are shared by the FCMs of all tasks
+  for (auto Ms : {&rMs, &tMs})
+    for (auto& mm : *Ms)
+      if (mm.child) mm.child = std::make_shared<STMMPar>(*mm.child);
 }
 
-inline void FCM::set_cont(std::vector<MMPar>& Ms) {
+void FCM::set_cont(std::unique_ptr<Param>& par, std::vector<MMPar>& Ms) {
   for (auto& m : Ms) {
     if (m.k > K_MAX_LGTBL8)
-      m.cont = Container::sketch_8;
+      m.cont = par->hashTable     ? Container::hash_table_16
+               : par->blockSketch ? Container::block_sketch_8
+                                  : Container::sketch_8;
     else if (m.k > K_MAX_TBL32)
       m.cont = Container::log_table_8;
+    else if (par->packTable && m.k <= K_MAX_TBL16)
+      m.cont = Container::table_16;
     else if (m.k > K_MAX_TBL64)
       m.cont = Container::table_32;
     else
@@ -220,7 +233,8 @@ inline void FCM::show_info(std::unique_ptr<Param>& par) const {
   rmm_row("Context size (k)", 'k');
   bool hasSketch{false};
   for (const auto& e : rMs)
-    if (e.cont == Container::sketch_8) {
+    if (e.cont == Container::sketch_8 ||
+        e.cont == Container::block_sketch_8) {
       hasSketch = true;
       break;
     }
@@ -258,7 +272,8 @@ inline void FCM::show_info(std::unique_ptr<Param>& par) const {
   rmm_row("Context size (k)", 'k');
   hasSketch = false;
   for (const auto& e : tMs)
-    if (e.cont == Container::sketch_8) {
+    if (e.cont == Container::sketch_8 ||
+        e.cont == Container::block_sketch_8) {
       hasSketch = true;
       break;
     }
@@ -310,29 +325,257 @@ inline void FCM::show_info(std::unique_ptr<Param>& par) const {
   botrule();
 }
 
-inline void FCM::alloc_model() {
-  for (const auto& m : rMs) {
+// Counters touched by feeding "n" symbols to a model, at most. The models of
+// short sequences, e.g. segments, are then sparse (see Storage)
+inline uint64_t FCM::touched(const MMPar& m, uint64_t n) {
+  const bool sketch{m.cont == Container::sketch_8 ||
+                    m.cont == Container::block_sketch_8};
+  return n * (m.ir == 2 ? 2 : 1) * (sketch ? m.d : 1);
+}
+
+// A model of "m" for "nSyms" symbols, from the pool if any. Its counters are
+// sparse only if "sparse" and few; a hash table is sized by them anyway
+inline void FCM::add_model(const MMPar& m, Pages pages, uint64_t nSyms,
+                           bool sparse) {
+  const auto n = (sparse || m.cont == Container::hash_table_16)
+                     ? touched(m, nSyms)
+                     : 0;
+  switch (m.cont) {
+    case Container::sketch_8:
+      cmls4.push_back(pool ? pool->get<CMLS4>(m, pages, n)
+                           : std::make_unique<CMLS4>(m.w, m.d, pages, n));
+      break;
+    case Container::block_sketch_8:
+      bcmls4.push_back(pool ? pool->get<BlockCMLS4>(m, pages, n)
+                            : std::make_unique<BlockCMLS4>(m.w, m.d, pages, n));
+      break;
+    case Container::hash_table_16:
+      hshtbl16.push_back(pool ? pool->get<HashTable16>(m, pages, n)
+                              : std::make_unique<HashTable16>(m.k, pages, n));
+      break;
+    case Container::log_table_8:
+      lgtbl8.push_back(pool ? pool->get<LogTable8>(m, pages, n)
+                            : std::make_unique<LogTable8>(m.k, pages, n));
+      break;
+    case Container::table_32:
+      tbl32.push_back(pool ? pool->get<Table32>(m, pages, n)
+                           : std::make_unique<Table32>(m.k, pages, n));
+      break;
+    case Container::table_16:
+      tbl16.push_back(pool ? pool->get<Table16>(m, pages, n)
+                           : std::make_unique<Table16>(m.k, pages, n));
+      break;
+    case Container::table_64:
+      tbl64.push_back(pool ? pool->get<Table64>(m, pages, n)
+                           : std::make_unique<Table64>(m.k, pages, n));
+      break;
+  }
+}
+
+// Hand the models over to the pool, if any, for other FCMs to reuse. Cached
+// models are mapped from their files, so they are only freed
+inline void FCM::give_back() {
+  if (pool && held) {
+    std::array<size_t, CONT_KINDS> nKind{};  // No. models, per container
+    for (size_t i = 0; i != held->size(); ++i) {
+      const auto& m = (*held)[i];
+      const auto j = nKind[static_cast<size_t>(m.cont)]++;
+      if (held == &rMs && cached[i]) continue;
+      switch (m.cont) {
+        case Container::sketch_8:
+          pool->put(m, std::move(cmls4[j]));
+          break;
+        case Container::block_sketch_8:
+          pool->put(m, std::move(bcmls4[j]));
+          break;
+        case Container::hash_table_16:
+          pool->put(m, std::move(hshtbl16[j]));
+          break;
+        case Container::log_table_8:
+          pool->put(m, std::move(lgtbl8[j]));
+          break;
+        case Container::table_32:
+          pool->put(m, std::move(tbl32[j]));
+          break;
+        case Container::table_16:
+          pool->put(m, std::move(tbl16[j]));
+          break;
+        case Container::table_64:
+          pool->put(m, std::move(tbl64[j]));
+          break;
+      }
+    }
+  }
+  cmls4.clear();
+  bcmls4.clear();
+  hshtbl16.clear();
+  lgtbl8.clear();
+  tbl32.clear();
+  tbl16.clear();
+  tbl64.clear();
+  held = nullptr;
+}
+
+inline void FCM::alloc_model(const ModelCache* cache, Pages pages,
+                             uint64_t nSyms, bool sparse) {
+  give_back();
+  held = &rMs;
+  cached.assign(rMs.size(), false);
+  contIdx.clear();
+  for (size_t i = 0; i != rMs.size(); ++i) {
+    const auto& m = rMs[i];
     switch (m.cont) {
       case Container::sketch_8:
-        cmls4.push_back(std::make_unique<CMLS4>(m.w, m.d));
+        contIdx.push_back(cmls4.size());
+        break;
+      case Container::block_sketch_8:
+        contIdx.push_back(bcmls4.size());
+        break;
+      case Container::hash_table_16:
+        contIdx.push_back(hshtbl16.size());
+        break;
+      case Container::log_table_8:
+        contIdx.push_back(lgtbl8.size());
+        break;
+      case Container::table_32:
+        contIdx.push_back(tbl32.size());
+        break;
+      case Container::table_16:
+        contIdx.push_back(tbl16.size());
+        break;
+      case Container::table_64:
+        contIdx.push_back(tbl64.size());
+        break;
+    }
+    cached[i] = cache != nullptr && cache->has(m);
+    if (cached[i]) {
+      const auto name{cache->name(m)};
+      switch (m.cont) {
+        case Container::sketch_8:
+          cmls4.push_back(
+              std::make_unique<CMLS4>(m.w, m.d, name, MDL_HDR_SIZE));
+          break;
+        case Container::block_sketch_8:
+          bcmls4.push_back(
+              std::make_unique<BlockCMLS4>(m.w, m.d, name, MDL_HDR_SIZE));
+          break;
+        case Container::hash_table_16:
+          hshtbl16.push_back(
+              std::make_unique<HashTable16>(m.k, name, MDL_HDR_SIZE));
+          break;
+        case Container::log_table_8:
+          lgtbl8.push_back(std::make_unique<LogTable8>(m.k, name, MDL_HDR_SIZE));
+          break;
+        case Container::table_32:
+          tbl32.push_back(std::make_unique<Table32>(m.k, name, MDL_HDR_SIZE));
+          break;
+        case Container::table_16:
+          tbl16.push_back(std::make_unique<Table16>(m.k, name, MDL_HDR_SIZE));
+          break;
+        case Container::table_64:
+          tbl64.push_back(std::make_unique<Table64>(m.k, name, MDL_HDR_SIZE));
+          break;
+      }
+      continue;
+    }
+
+    add_model(m, pages, nSyms, sparse);
+  }
+}
+
+// Bytes the ref models would take, built from "nSyms" symbols
+auto FCM::model_bytes(uint64_t nSyms) const -> uint64_t {
+  uint64_t bytes = 0;
+  for (const auto& m : rMs) bytes += model_bytes(m, nSyms);
+  return bytes;
+}
+
+// Bytes a model of "m" would take, built from "nSyms" symbols, as add_model
+auto FCM::model_bytes(const MMPar& m, uint64_t nSyms, bool sparse)
+    -> uint64_t {
+  const auto n = (sparse || m.cont == Container::hash_table_16)
+                     ? touched(m, nSyms)
+                     : 0;
+  switch (m.cont) {
+    case Container::sketch_8:
+      return CMLS4::bytes(m.w, m.d, n);
+    case Container::block_sketch_8:
+      return BlockCMLS4::bytes(m.w, m.d, n);
+    case Container::hash_table_16:
+      return HashTable16::bytes(n);
+    case Container::log_table_8:
+      return LogTable8::bytes(m.k, n);
+    case Container::table_32:
+      return Table32::bytes(m.k, n);
+    case Container::table_16:
+      return Table16::bytes(m.k, n);
+    case Container::table_64:
+      return Table64::bytes(m.k, n);
+  }
+  return 0;
+}
+
+inline void FCM::save_model(const ModelCache& cache) const {
+  auto tbl64_iter = std::begin(tbl64);
+  auto tbl32_iter = std::begin(tbl32);
+  auto tbl16_iter = std::begin(tbl16);
+  auto lgtbl8_iter = std::begin(lgtbl8);
+  auto cmls4_iter = std::begin(cmls4);
+  auto bcmls4_iter = std::begin(bcmls4);
+  auto hshtbl16_iter = std::begin(hshtbl16);
+
+  for (size_t i = 0; i != rMs.size(); ++i) {
+    switch (rMs[i].cont) {
+      case Container::sketch_8:
+        if (!cached[i]) cache.save(rMs[i], **cmls4_iter);
+        ++cmls4_iter;
+        break;
+      case Container::block_sketch_8:
+        if (!cached[i]) cache.save(rMs[i], **bcmls4_iter);
+        ++bcmls4_iter;
+        break;
+      case Container::hash_table_16:
+        if (!cached[i]) cache.save(rMs[i], **hshtbl16_iter);
+        ++hshtbl16_iter;
         break;
       case Container::log_table_8:
-        lgtbl8.push_back(std::make_unique<LogTable8>(m.k));
+        if (!cached[i]) cache.save(rMs[i], **lgtbl8_iter);
+        ++lgtbl8_iter;
         break;
       case Container::table_32:
-        tbl32.push_back(std::make_unique<Table32>(m.k));
+        if (!cached[i]) cache.save(rMs[i], **tbl32_iter);
+        ++tbl32_iter;
+        break;
+      case Container::table_16:
+        if (!cached[i]) cache.save(rMs[i], **tbl16_iter);
+        ++tbl16_iter;
         break;
       case Container::table_64:
-        tbl64.push_back(std::make_unique<Table64>(m.k));
+        if (!cached[i]) cache.save(rMs[i], **tbl64_iter);
+        ++tbl64_iter;
         break;
     }
   }
 }
 
 void FCM::store(std::unique_ptr<Param>& par, uint8_t round) {
+  // Only the models of the main reference are worth caching; the segments of
+  // rounds 2 and 3 are temporary
+  std::unique_ptr<ModelCache> cache;
+  if (round == 1 && !par->modelDir.empty())
+    cache = std::make_unique<ModelCache>(par->modelDir, par->ref);
+  // Cached models are written whole, so are never sparse. Neither are those
+  // of the main reference, which all threads build and which are read by
+  // index; those of the segments may be
+  alloc_model(cache.get(), par->pages, cache ? 0 : par->views->size(par->ref),
+              round != 1);
+  const auto n_cached = std::count(std::begin(cached), std::end(cached), true);
+
   if (round == 1 || par->verbose) {
     par->message = (round == 3) ? "    " : "";
-    par->message += "[+] Creating model";
+    par->message +=
+        n_cached == static_cast<int64_t>(rMs.size()) ? "[+] Loading model"
+                                                      : "[+] Creating model";
     if (rMs.size() > 1) par->message += "s";
     par->message += " of ";
     par->message += tarSegMsg.empty()
@@ -342,463 +585,1014 @@ void FCM::store(std::unique_ptr<Param>& par, uint8_t round) {
     std::cerr << par->message << "...";
   }
 
-  (par->nthr == 1 || rMs.size() == 1) ? store_1(par)
-                                      : store_n(par) /*Multiple threads*/;
+  if (n_cached != static_cast<int64_t>(rMs.size())) {
+    (par->nthr == 1) ? store_1(par) : store_n(par) /*Multiple threads*/;
+    if (cache) save_model(*cache);
+  }
 
-  if (round == 1 || par->verbose)
-    std::cerr << "\r" << par->message << "done." << '\n';
+  if (round == 1 || par->verbose) {
+    std::cerr << "\r" << par->message << "done.";
+    if (par->verbose) std::cerr << " Pages: " << page_info() << ".";
+    std::cerr << '\n';
+  }
 }
 
-inline void FCM::store_1(std::unique_ptr<Param>& par) {
-  auto tbl64_iter = std::begin(tbl64);
-  auto tbl32_iter = std::begin(tbl32);
-  auto lgtbl8_iter = std::begin(lgtbl8);
-  auto cmls4_iter = std::begin(cmls4);
+inline auto FCM::is_sparse(size_t i) const -> bool {
+  switch (rMs[i].cont) {
+    case Container::sketch_8:
+      return cmls4[contIdx[i]]->is_sparse();
+    case Container::block_sketch_8:
+      return bcmls4[contIdx[i]]->is_sparse();
+    case Container::hash_table_16:
+      return hshtbl16[contIdx[i]]->is_sparse();
+    case Container::log_table_8:
+      return lgtbl8[contIdx[i]]->is_sparse();
+    case Container::table_32:
+      return tbl32[contIdx[i]]->is_sparse();
+    case Container::table_16:
+      return tbl16[contIdx[i]]->is_sparse();
+    case Container::table_64:
+      return tbl64[contIdx[i]]->is_sparse();
+  }
+  return false;
+}
 
-  for (const auto& m : rMs) {  // Mask: 1<<2k - 1 = 4^k - 1
-    switch (m.cont) {
-      case Container::log_table_8:
-        store_impl(par->ref, (1ul << (2 * m.k)) - 1ul /*Mask 32*/,
-                   lgtbl8_iter++);
-        break;
+// Size of the pages each ref model got, e.g. "2 MB, 4 KB, sparse"
+inline auto FCM::page_info() const -> std::string {
+  std::string info;
+  for (size_t i = 0; i != rMs.size(); ++i) {
+    uint64_t page = 0;
+    switch (rMs[i].cont) {
       case Container::sketch_8:
-        store_impl(par->ref, (1ull << (2 * m.k)) - 1ull /*Mask 64*/,
-                   cmls4_iter++);
+        page = cmls4[contIdx[i]]->page_size();
         break;
-      case Container::table_64:
-        store_impl(par->ref, (1ul << (2 * m.k)) - 1ul /*Mask 32*/,
-                   tbl64_iter++);
+      case Container::block_sketch_8:
+        page = bcmls4[contIdx[i]]->page_size();
+        break;
+      case Container::hash_table_16:
+        page = hshtbl16[contIdx[i]]->page_size();
+        break;
+      case Container::log_table_8:
+        page = lgtbl8[contIdx[i]]->page_size();
         break;
       case Container::table_32:
-        store_impl(par->ref, (1ul << (2 * m.k)) - 1ul /*Mask 32*/,
-                   tbl32_iter++);
+        page = tbl32[contIdx[i]]->page_size();
         break;
-      default:
+      case Container::table_16:
+        page = tbl16[contIdx[i]]->page_size();
+        break;
+      case Container::table_64:
+        page = tbl64[contIdx[i]]->page_size();
         break;
     }
+    if (i != 0) info += ", ";
+    info += is_sparse(i)               ? std::string("sparse")
+            : (page >= (1ull << 30))   ? std::to_string(page >> 30) + " GB"
+            : (page >= (1ull << 20))   ? std::to_string(page >> 20) + " MB"
+                                       : std::to_string(page >> 10) + " KB";
   }
+  return info;
 }
 
+inline void FCM::store_1(std::unique_ptr<Param>& par) {
+  auto rf = par->views->open(par->ref);
+  std::vector<uint64_t> ctx(rMs.size(), 0);
+
+  for (PackedSeq seq; seq.load(*rf, REF_CHUNK) != 0;)
+    for (size_t i = 0; i != rMs.size(); ++i)
+      if (!cached[i]) store_model(seq, i, ctx[i]);
+}
+
+// The reference is decoded once, a chunk at a time, and shared by all models.
+// While the models are fed a chunk, the next one is decoded. With at least as
+// many models to build as threads, each thread builds its own models;
+// otherwise, the models are built one after another, each by all threads.
 inline void FCM::store_n(std::unique_ptr<Param>& par) {
-  auto tbl64_iter = std::begin(tbl64);
-  auto tbl32_iter = std::begin(tbl32);
-  auto lgtbl8_iter = std::begin(lgtbl8);
-  auto cmls4_iter = std::begin(cmls4);
-  const auto vThrSz = (par->nthr < rMs.size()) ? par->nthr : rMs.size();
+  auto rf = par->views->open(par->ref);
+  std::vector<uint64_t> ctx(rMs.size(), 0);
+  const auto nBuild = static_cast<size_t>(
+      std::count(std::begin(cached), std::end(cached), false));
+  const auto vThrSz = (par->nthr < nBuild) ? par->nthr : nBuild;
   std::vector<std::thread> thrd(vThrSz);
+  uint64_t pos = 0;  // No. bases before the chunk
+
+  PackedSeq seq, next;
+  for (seq.load(*rf, REF_CHUNK); seq.size() != 0; std::swap(seq, next)) {
+    std::thread reader([&]() { next.load(*rf, REF_CHUNK); });
+    if (par->nthr > nBuild) {
+      for (size_t i = 0; i != rMs.size(); ++i)
+        if (!cached[i]) store_model_n(seq, i, ctx[i], pos, par->nthr);
+    } else {
+      for (size_t t = 0; t != vThrSz; ++t)
+        thrd[t] = std::thread([&, t]() {
+          for (size_t i = 0, j = 0; i != rMs.size(); ++i)
+            if (!cached[i] && j++ % vThrSz == t) store_model(seq, i, ctx[i]);
+        });
+      for (auto& t : thrd) t.join();
+    }
+    pos += seq.size();
+    reader.join();
+  }
+}
 
-  for (uint8_t i = 0; i != rMs.size(); ++i) {  // Mask: 1<<2k-1 = 4^k-1
-    switch (rMs[i].cont) {
-      case Container::sketch_8:
-        thrd[i % vThrSz] = std::thread(
-            &FCM::store_impl<uint64_t, decltype(cmls4_iter)>, this,
-            std::cref(par->ref), (1ull << (2 * rMs[i].k)) - 1ull, cmls4_iter++);
-        break;
-      case Container::log_table_8:
-        thrd[i % vThrSz] = std::thread(
-            &FCM::store_impl<uint32_t, decltype(lgtbl8_iter)>, this,
-            std::cref(par->ref), (1ul << (2 * rMs[i].k)) - 1ul, lgtbl8_iter++);
-        break;
-      case Container::table_64:
-        thrd[i % vThrSz] = std::thread(
-            &FCM::store_impl<uint32_t, decltype(tbl64_iter)>, this,
-            std::cref(par->ref), (1ul << (2 * rMs[i].k)) - 1ul, tbl64_iter++);
-        break;
-      case Container::table_32:
-        thrd[i % vThrSz] = std::thread(
-            &FCM::store_impl<uint32_t, decltype(tbl32_iter)>, this,
-            std::cref(par->ref), (1ul << (2 * rMs[i].k)) - 1ul, tbl32_iter++);
-        break;
-      default:
-        break;
+inline void FCM::store_model(const PackedSeq& seq, size_t i, uint64_t& ctx) {
+  const auto mask{(1ull << (2 * rMs[i].k)) - 1ull};  // 1<<2k - 1 = 4^k - 1
+  switch (rMs[i].cont) {
+    case Container::sketch_8:
+      store_impl(seq, mask, ctx, cmls4[contIdx[i]]);
+      break;
+    case Container::block_sketch_8:
+      store_impl(seq, mask, ctx, bcmls4[contIdx[i]]);
+      break;
+    case Container::hash_table_16:
+      store_impl(seq, mask, ctx, hshtbl16[contIdx[i]]);
+      break;
+    case Container::log_table_8:
+      store_impl(seq, mask, ctx, lgtbl8[contIdx[i]]);
+      break;
+    case Container::table_32:
+      store_impl(seq, mask, ctx, tbl32[contIdx[i]]);
+      break;
+    case Container::table_16:
+      store_impl(seq, mask, ctx, tbl16[contIdx[i]]);
+      break;
+    case Container::table_64:
+      store_impl(seq, mask, ctx, tbl64[contIdx[i]]);
+      break;
+  }
+}
+
+// The context PREFETCH_DIST bases ahead is computed first and its counters
+// prefetched, so that they are in cache when updated
+template <typename Cont>
+inline void FCM::store_impl(const PackedSeq& seq, uint64_t mask, uint64_t& ctx,
+                            Cont& cont) {
+  const auto n{seq.size()};
+  auto ctxAhead{ctx};
+  for (uint64_t i = 0; i != std::min(PREFETCH_DIST, n); ++i) {
+    ctxAhead = ((ctxAhead & mask) << 2u) | seq[i];
+    cont->prefetch(ctxAhead);
+  }
+  for (uint64_t i = 0; i != n; ++i) {
+    if (i + PREFETCH_DIST < n) {
+      ctxAhead = ((ctxAhead & mask) << 2u) | seq[i + PREFETCH_DIST];
+      cont->prefetch(ctxAhead);
     }
-    // Join
-    if ((i + 1) % vThrSz == 0)
-      for (auto& t : thrd)
-        if (t.joinable()) t.join();
+    ctx = ((ctx & mask) << 2u) | seq[i];
+    cont->update(ctx);
   }
-  for (auto& t : thrd)
-    if (t.joinable()) t.join();  // Join leftover threads
-}
-
-template <typename Mask, typename ContIter /*Container iterator*/>
-inline void FCM::store_impl(std::string ref, Mask mask, ContIter cont) {
-  std::ifstream rf(ref);
-  Mask ctx = 0;
-  
-  for (std::vector<char> buffer(FILE_READ_BUF, 0); rf.peek() != EOF;) {
-    rf.read(buffer.data(), FILE_READ_BUF);
-    for (auto it = std::begin(buffer); it != std::begin(buffer) + rf.gcount();
-         ++it) {
-      const auto c = *it;
-      if (c != '\n') {
-        ctx = ((ctx & mask) << 2u) | base_code(c);
-        (*cont)->update(ctx);
+}
+
+// Feed a chunk to model i by "nthr" threads. A context of a sketch hits
+// cells all over it, so each thread feeds a part of the chunk, starting from
+// the context k+1 bases back (approximate, see CMLS4::update). A table is fed
+// by ranges of rows instead, exactly (see store_shards_n). A hash table grows
+// as it is fed, and so do sparse counters (see Storage), so they are fed here
+// alone.
+inline void FCM::store_model_n(const PackedSeq& seq, size_t i, uint64_t& ctx,
+                               uint64_t pos, uint8_t nthr) {
+  const auto& m = rMs[i];
+  if (m.cont == Container::hash_table_16 || is_sparse(i)) {
+    store_model(seq, i, ctx);
+    return;
+  }
+  const auto mask{(1ull << (2 * m.k)) - 1ull};
+  std::vector<std::thread> thrd(nthr);
+
+  switch (m.cont) {
+    case Container::sketch_8:
+    case Container::block_sketch_8:
+      for (uint8_t t = 0; t != nthr; ++t) {
+        const auto beg{seq.size() * t / nthr};
+        const auto end{seq.size() * (t + 1) / nthr};
+        thrd[t] = std::thread([&, beg, end]() {
+          const auto c{ctx_at(seq, beg, ctx, m.k)};
+          if (m.cont == Container::sketch_8)
+            store_impl_n(seq, beg, end, mask, c, pos, cmls4[contIdx[i]]);
+          else
+            store_impl_n(seq, beg, end, mask, c, pos, bcmls4[contIdx[i]]);
+        });
       }
+      for (auto& t : thrd) t.join();
+      break;
+    case Container::log_table_8:
+      store_shards_n(seq, m.k, ctx, pos, lgtbl8[contIdx[i]], nthr);
+      break;
+    case Container::table_32:
+      store_shards_n(seq, m.k, ctx, pos, tbl32[contIdx[i]], nthr);
+      break;
+    case Container::table_16:
+      store_shards_n(seq, m.k, ctx, pos, tbl16[contIdx[i]], nthr);
+      break;
+    case Container::table_64:
+      store_shards_n(seq, m.k, ctx, pos, tbl64[contIdx[i]], nthr);
+      break;
+    case Container::hash_table_16:  // Fed above
+      break;
+  }
+
+  ctx = ctx_at(seq, seq.size(), ctx, m.k);
+}
+
+// Update the contexts at [beg, end) of a chunk, by many threads at once, each
+// on its own part. "pos" is no. bases before chunk
+template <typename Cont>
+inline void FCM::store_impl_n(const PackedSeq& seq, uint64_t beg, uint64_t end,
+                              uint64_t mask, uint64_t ctx, uint64_t pos,
+                              Cont& cont) const {
+  auto ctxAhead{ctx};  // As in store_impl
+  for (auto i = beg; i != std::min(beg + PREFETCH_DIST, end); ++i) {
+    ctxAhead = ((ctxAhead & mask) << 2u) | seq[i];
+    cont->prefetch(ctxAhead);
+  }
+  for (auto i = beg; i != end; ++i) {
+    if (i + PREFETCH_DIST < end) {
+      ctxAhead = ((ctxAhead & mask) << 2u) | seq[i + PREFETCH_DIST];
+      cont->prefetch(ctxAhead);
     }
+    ctx = ((ctx & mask) << 2u) | seq[i];
+    cont->update(ctx, pos + i);
+  }
+}
+
+// The rows of a table, 4^(k+1) contexts, are split in "nthr" equal ranges,
+// the shards, so that a row is only updated by one thread. The chunk is fed
+// SHARD_SPAN bases at a time: each thread puts the contexts of a part of the
+// span in buckets, by shard; then each updates its shard from the buckets of
+// all parts, in order. So every counter sees the same updates, in the same
+// order, as in store_model, and each thread reads 1/nthr of the chunk.
+// "ctx" is the context before the chunk, "pos" no. bases before it
+template <typename Cont>
+inline void FCM::store_shards_n(const PackedSeq& seq, uint8_t k, uint64_t ctx,
+                                uint64_t pos, Cont& cont, uint8_t nthr) const {
+  const auto mask{(1ull << (2 * k)) - 1ull};
+  const auto shift{static_cast<uint8_t>(2 * k)};  // Rows: 4^(k+1) >> 2
+  std::vector<std::vector<Bucketed>> buckets(nthr * nthr);  // [part][shard]
+  std::vector<std::thread> thrd(nthr);
+
+  for (uint64_t b = 0; b < seq.size(); b += SHARD_SPAN) {
+    const auto e{std::min(b + SHARD_SPAN, seq.size())};
+    for (uint8_t t = 0; t != nthr; ++t)
+      thrd[t] = std::thread([&, t]() {
+        const auto beg{b + (e - b) * t / nthr};
+        const auto end{b + (e - b) * (t + 1) / nthr};
+        const auto part{std::begin(buckets) + t * nthr};
+        for (uint8_t s = 0; s != nthr; ++s) part[s].clear();
+        auto c{ctx_at(seq, beg, ctx, k)};
+        for (auto i = beg; i != end; ++i) {
+          c = ((c & mask) << 2u) | seq[i];
+          part[((c >> 2u) * nthr) >> shift].push_back(
+              Bucketed{static_cast<uint32_t>(c), static_cast<uint32_t>(i)});
+        }
+      });
+    for (auto& t : thrd) t.join();
+
+    for (uint8_t s = 0; s != nthr; ++s)
+      thrd[s] = std::thread([&, s]() {
+        for (uint8_t t = 0; t != nthr; ++t) {
+          const auto& bucket = buckets[t * nthr + s];
+          const auto n{bucket.size()};
+          for (size_t j = 0; j != std::min(PREFETCH_DIST, n); ++j)
+            cont->prefetch(bucket[j].ctx);
+          for (size_t j = 0; j != n; ++j) {
+            if (j + PREFETCH_DIST < n)
+              cont->prefetch(bucket[j + PREFETCH_DIST].ctx);
+            cont->update(bucket[j].ctx, pos + bucket[j].at);
+          }
+        }
+      });
+    for (auto& t : thrd) t.join();
+  }
+}
+
+// Context after the bases before position p of a chunk. "ctx" is the context
+// before the chunk; it only matters if p <= k
+inline uint64_t FCM::ctx_at(const PackedSeq& seq, uint64_t p, uint64_t ctx,
+                            uint8_t k) const {
+  const auto mask{(1ull << (2 * k)) - 1ull};
+  for (auto i = (p > k + 1u) ? p - k - 1u : 0; i != p; ++i)
+    ctx = ((ctx & mask) << 2u) | seq[i];
+  return ctx;
+}
+
+// Regular and inverted modes in one pass over the target (round 1). Each mode
+// has its own profile, as if compressed with par->ID = 0 and 1, which goes to
+// rings[ID], and to a file if saved.
+void FCM::compress_both(std::unique_ptr<Param>& par,
+                        const std::vector<ProfileRing*>& rings) {
+  par->message = "[+] Compressing " + italic(par->tarName) + " ";
+  std::cerr << par->message << "...";
+
+  const bool save{par->saveProfile || par->saveAll};
+  std::vector<Lane> lanes;
+  for (uint8_t ID = 0; ID != 2; ++ID) {
+    lanes.emplace_back(rMs, ID, rings[ID]);
+    if (save) save_profile(par, lanes.back());
+  }
+  compress_lanes(par, lanes);
+
+  std::cerr << "\r" << par->message << "done.";
+  if (par->verbose)
+    std::cerr << " Ave. entropy = "
+              << fixed_precision(PREC_PRF, lanes[0].sumEnt / lanes[0].symsNo)
+              << " (regular), "
+              << fixed_precision(PREC_PRF, lanes[1].sumEnt / lanes[1].symsNo)
+              << " (inverted) bps.";
+  std::cerr << '\n';
+}
+
+FCM::Lane::Lane(const std::vector<MMPar>& Ms_, uint8_t ir_,
+                ProfileRing* ring_)
+    : Ms(Ms_), ir(ir_), ring(ring_), sumEnt(0), symsNo(0), ctx(0), ctxIr(0) {
+  for (auto& mm : Ms) {  // Make all IRs consistent
+    mm.ir = ir;
+    if (mm.child) {  // The tolerant models keep a history, so own ones
+      mm.child = std::make_shared<STMMPar>(*mm.child);
+      mm.child->ir = ir;
+    }
+  }
+  entropies.reserve(FILE_WRITE_BUF);
+}
+
+void FCM::Lane::write_entropies() {
+  if (prf.is_open()) prf.write(entropies);
+  if (ring) {
+    std::vector<float> values(entropies.size());
+    std::transform(std::begin(entropies), std::end(entropies),
+                   std::begin(values), prf_value);
+    ring->push(values);
   }
+  entropies.clear();
+}
 
-  rf.close();
+// The profile of a lane goes to the file named after its mode (ID), ref and
+// tar, with the models of the lane as -rm would give them
+void FCM::save_profile(std::unique_ptr<Param>& par, Lane& lane) const {
+  ProfileHeader header;
+  header.ir = lane.ir;
+  header.sampleStep = par->sampleStep;
+  header.ref = file_name(par->ref);
+  header.tar = file_name(par->tar);
+  for (const auto& mm : lane.Ms) {
+    uint64_t logW{0};
+    while (mm.w >> (logW + 1)) ++logW;
+    header.models += std::to_string(mm.k) + "," + std::to_string(logW) + "," +
+                     std::to_string(mm.d) + "," + std::to_string(mm.ir) + "," +
+                     precision(6, mm.alpha) + "," + precision(6, mm.gamma);
+    if (mm.child)
+      header.models += "/" + std::to_string(mm.child->thresh) + "," +
+                       std::to_string(mm.child->ir) + "," +
+                       precision(6, mm.child->alpha) + "," +
+                       precision(6, mm.child->gamma);
+    header.models += ":";
+  }
+  if (!header.models.empty()) header.models.pop_back();
+  lane.prf.open(gen_name(lane.ir, par->ref, par->tar, Format::profile),
+                header);
 }
 
-void FCM::compress(std::unique_ptr<Param>& par, uint8_t round) {
+// Round 2 compresses one target, the ref of round 1, by the models of each
+// segment of the round 1 target. Instead of a pass over the target per
+// segment, there is one: each block of it is read once and fed to the models
+// of all segments (see compress_jobs). Each FCM has its own lane and profile,
+// named after its par, which goes to rings[i], and gets its aveEnt. The pars
+// are of scheduler tasks, so run by one thread each; the target is compressed
+// by "nthr" threads, those of the caller
+void FCM::compress_batch(std::vector<std::unique_ptr<Param>>& pars,
+                         std::vector<std::unique_ptr<FCM>>& models,
+                         uint8_t round, const std::vector<ProfileRing*>& rings,
+                         uint8_t nthr) {
+  if (models.empty()) return;
+  // The target and the settings are those of all
+  auto par = pars[0]->task(pars[0]->ref, pars[0]->tar);
+  par->nthr = nthr;
   if (par->verbose) {
     par->message = (round == 3) ? "    " : "";
-    par->message += "[+] Compressing " + italic(par->tarName) + " ";
-  } else {
-    if (round == 1) {
-      par->message =
-          "[+] Compressing & filtering " + italic(par->tarName) + " ";
-      std::cerr << par->message << "...";
-    }
+    par->message += "[+] Compressing " + italic(par->tarName) + " by " +
+                    std::to_string(models.size()) + " model set" +
+                    (models.size() == 1 ? " " : "s ");
+    std::cerr << par->message << "...";
+  }
+
+  std::vector<std::vector<Lane>> lanes(models.size());
+  std::vector<Job> jobs;
+  for (size_t i = 0; i != models.size(); ++i) {
+    auto& p = pars[i];
+    lanes[i].emplace_back(models[i]->rMs, p->ID, rings[i]);
+    if (p->saveProfile || p->saveAll) models[i]->save_profile(p, lanes[i][0]);
+    models[i]->init_lanes(lanes[i]);
+    jobs.push_back(Job{models[i].get(), &lanes[i]});
   }
+  compress_jobs(par, jobs);
+
+  if (par->verbose) std::cerr << "\r" << par->message << "finished.\n";
+  for (size_t i = 0; i != models.size(); ++i) {
+    lanes[i][0].prf.close();
+    models[i]->aveEnt = lanes[i][0].sumEnt / lanes[i][0].symsNo;
+    if (par->verbose)
+      std::cerr << ((round == 3) ? "        " : "    ") << "[-] By "
+                << italic(pars[i]->refName) << ": ave. entropy = "
+                << fixed_precision(PREC_PRF, models[i]->aveEnt) << " bps.\n";
+  }
+}
+
+void FCM::compress_lanes(std::unique_ptr<Param>& par,
+                         std::vector<Lane>& lanes) {
+  init_lanes(lanes);
+  std::vector<Job> jobs{Job{this, &lanes}};
+  compress_jobs(par, jobs);
+
+  for (auto& lane : lanes) lane.prf.close();
+  aveEnt = lanes[0].sumEnt / lanes[0].symsNo;
+}
 
+inline void FCM::init_lanes(std::vector<Lane>& lanes) const {
+  for (auto& lane : lanes)
+    (rMs.size() == 1 && rTMsSize == 0) ? init_lane_1(lane) : init_lane_n(lane);
+}
+
+// Feed a block to the lanes. Reads the models only, so many threads may feed
+// the lanes of their own at once
+void FCM::feed(std::vector<Lane>& lanes, const Block& block) const {
   if (rMs.size() == 1 && rTMsSize == 0)  // 1 MM
     switch (rMs[0].cont) {
       case Container::sketch_8:
-        compress_1(par, std::begin(cmls4));
+        feed_1(lanes, block, std::begin(cmls4));
+        break;
+      case Container::block_sketch_8:
+        feed_1(lanes, block, std::begin(bcmls4));
+        break;
+      case Container::hash_table_16:
+        feed_1(lanes, block, std::begin(hshtbl16));
         break;
       case Container::log_table_8:
-        compress_1(par, std::begin(lgtbl8));
+        feed_1(lanes, block, std::begin(lgtbl8));
         break;
       case Container::table_32:
-        compress_1(par, std::begin(tbl32));
+        feed_1(lanes, block, std::begin(tbl32));
+        break;
+      case Container::table_16:
+        feed_1(lanes, block, std::begin(tbl16));
         break;
       case Container::table_64:
-        compress_1(par, std::begin(tbl64));
+        feed_1(lanes, block, std::begin(tbl64));
         break;
     }
   else
-    compress_n(par);
+    with_pipeline(lanes[0].Ms, [&](const auto& pipe) {
+      feed_lanes(lanes, block,
+                 [this, &pipe](Lane& lane, char c, bool) {
+                   return mix_symbol<false>(lane.cp, pipe, lane.Ms, lane.ir,
+                                            c);
+                 },
+                 true);
+    });
+}
 
-  if (par->verbose) {
-    std::cerr << "\r" << par->message << "finished. Ave. entropy = "
-              << fixed_precision(PREC_PRF, aveEnt) << " bps." << '\n';
-  } else {
-    // if (round == 1) std::cerr << "\r" << par->message << "...";
+template <typename ContIter>
+inline void FCM::feed_1(std::vector<Lane>& lanes, const Block& block,
+                        ContIter cont) const {
+  feed_lanes(lanes, block,
+             [this, cont](Lane& lane, char c, bool sample_taken) {
+               return compress_1_sym(cont, lane, c, sample_taken);
+             },
+             false);
+}
+
+// Feed the block by "step" per symbol. The entropy of every symbol counts in
+// the average if "allSyms", otherwise only sampled ones
+template <typename Step>
+inline void FCM::feed_lanes(std::vector<Lane>& lanes, const Block& block,
+                            Step step, bool allSyms) const {
+  for (auto i = block.from; i != block.beg; ++i)
+    for (auto& lane : lanes) step(lane, block.seq[i], false);
+
+  for (auto i = block.beg; i != block.end; ++i) {
+    const bool sample_taken = ((block.base + i) % block.sampleStep == 0);
+    for (auto& lane : lanes) {
+      const auto entr = step(lane, block.seq[i], sample_taken);
+      if (sample_taken || allSyms) {
+        ++lane.symsNo;
+        lane.sumEnt += entr;
+      }
+      if (sample_taken) lane.entropies.push_back(entr);
+    }
   }
 }
 
-template <typename ContIter>
-void FCM::compress_1(std::unique_ptr<Param>& par, ContIter cont) {
-  uint64_t ctx{0};  // Ctx, Mir (int) sliding through the dataset
-  uint64_t ctxIr{(1ull << (2 * rMs[0].k)) - 1};
-  uint64_t symsNo{0};  // No. syms in target file, except \n
-  prc_t sumEnt{0};     // Sum of entropies = sum(log_2 P(s|c^t))
-  ProbPar prob_par{rMs[0].alpha, ctxIr /* mask: 1<<2k-1=4^k-1 */,
-                   static_cast<uint8_t>(rMs[0].k << 1u)};
-  std::ifstream tar_file(par->tar);
-  std::ofstream prf_file(
-      gen_name(par->ID, par->ref, par->tar, Format::profile));
-  const auto totalSize = file_size(par->tar);
-  std::vector<prc_t> entropies;
-  entropies.reserve(FILE_WRITE_BUF);
-  auto write_entropies = [&]() {
-    for (auto e : entropies) prf_file << precision(PREC_PRF, e) << '\n';
-  };
-  uint64_t sample_step_index = 0;
-
-  for (std::vector<char> buffer(FILE_READ_BUF, 0); tar_file.peek() != EOF;) {
-    tar_file.read(buffer.data(), FILE_READ_BUF);
-    for (auto it = std::begin(buffer);
-         it != std::begin(buffer) + tar_file.gcount(); ++it) {
-      auto c = *it;
-      if (c == '\n') continue;
-
-      prc_t entr;
-      bool sample_taken = (sample_step_index % par->sampleStep == 0);
-
-      if (rMs[0].ir == 0) {  // Branch prediction: 1 miss, totalSize-1 hits
-        if (c != 'N') {
-          prob_par.config_ir0(c, ctx);
-          if (sample_taken) {
-            auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, prob_par.l);
-            entr = entropy(std::begin(f), &prob_par);
-          }
-        } else {
-          // c = TAR_ALT_N;//todo
-          prob_par.config_ir0(c, ctx);
-          entr = entropyN;
+// Feed the target to the lanes of all jobs, reading it once
+void FCM::compress_jobs(std::unique_ptr<Param>& par, std::vector<Job>& jobs) {
+  if (par->nthr > 1 && par->views->size(par->tar) > TAR_CHUNK)
+    compress_chunks(par, jobs);
+  else
+    compress_stream(par, jobs);
+}
+
+// Append the symbols of the file to seq, up to "n" of them, skipping newlines
+void FCM::read_block(std::istream& file, std::vector<char>& seq, uint64_t n) {
+  std::vector<char> buffer(FILE_READ_BUF, 0);
+  while (seq.size() < n && file.peek() != EOF) {
+    file.read(buffer.data(), FILE_READ_BUF);
+    std::copy_if(std::begin(buffer), std::begin(buffer) + file.gcount(),
+                 std::back_inserter(seq), [](char c) { return c != '\n'; });
+  }
+}
+
+// The target is read in blocks, each fed to the jobs in turn. With many jobs,
+// e.g., in round 2, par->nthr threads take them, one job at a time. Every job
+// is fed by one thread, so are its profiles
+void FCM::compress_stream(std::unique_ptr<Param>& par, std::vector<Job>& jobs) {
+  const auto tar_in = par->views->open(par->tar);
+  auto& tar_file = *tar_in;
+  const auto totalSize = par->views->size(par->tar);
+  const auto nThr = std::min<uint64_t>(par->nthr, jobs.size());
+  std::vector<char> seq;
+  uint64_t idx = 0;  // No. symbols before the block
+
+  while (tar_file.peek() != EOF) {
+    seq.clear();
+    read_block(tar_file, seq, TAR_CHUNK);
+    const Block block{seq.data(), 0, 0, seq.size(), idx, par->sampleStep};
+
+    std::atomic<size_t> next{0};
+    const auto feed_jobs = [&]() {
+      for (size_t j; (j = next++) < jobs.size();) {
+        jobs[j].fcm->feed(*jobs[j].lanes, block);
+        for (auto& lane : *jobs[j].lanes) lane.write_entropies();
+      }
+    };
+    std::vector<std::thread> thrd;
+    for (uint64_t t = 1; t < nThr; ++t) thrd.emplace_back(feed_jobs);
+    feed_jobs();
+    for (auto& t : thrd) t.join();
+
+    idx += seq.size();
+    if (par->verbose)
+      std::cerr << par->message << "[" << (idx * 100) / totalSize << "%]\r";
+  }
+}
+
+// The target is read in blocks of par->nthr chunks, which are compressed by
+// one thread each and put back in order. A chunk starts with the models state
+// (contexts, weights, tolerant models) from scratch, warmed up on the
+// par->warmUp symbols before it. So, the profile is that of one thread, except
+// for a few symbols after each warm-up; with a single model without tolerant
+// model, it is the same if the warm-up is at least k. A thread compresses its
+// chunk for all jobs.
+void FCM::compress_chunks(std::unique_ptr<Param>& par, std::vector<Job>& jobs) {
+  const auto tar_in = par->views->open(par->tar);
+  auto& tar_file = *tar_in;
+  const auto totalSize = par->views->size(par->tar);
+  const auto nChunks = static_cast<uint64_t>(par->nthr);
+  const auto warm = static_cast<uint64_t>(par->warmUp);
+  std::vector<char> seq;  // Warm-up history, followed by the block
+  uint64_t hist = 0;      // No. symbols of history
+  uint64_t idx = 0;       // No. symbols before the block
+  std::vector<std::vector<std::vector<Lane>>> work(nChunks);  // Chunk, job
+
+  while (tar_file.peek() != EOF) {
+    seq.erase(std::begin(seq), std::end(seq) - hist);
+    read_block(tar_file, seq, hist + nChunks * TAR_CHUNK);
+    const auto n = seq.size() - hist;
+    const auto len = (n + nChunks - 1) / nChunks;
+
+    const auto compress_chunk = [&](uint64_t t, uint64_t beg, uint64_t end) {
+      const Block block{seq.data(), (beg > warm) ? beg - warm : 0, beg, end,
+                        idx - hist, par->sampleStep};
+      for (size_t j = 0; j != jobs.size(); ++j) {
+        jobs[j].fcm->init_lanes(work[t][j]);
+        jobs[j].fcm->feed(work[t][j], block);
+      }
+    };
+
+    std::vector<std::thread> thrd;
+    for (uint64_t t = 0; t != nChunks; ++t) {
+      work[t].clear();
+      work[t].resize(jobs.size());
+      for (size_t j = 0; j != jobs.size(); ++j)
+        for (const auto& lane : *jobs[j].lanes)
+          work[t][j].emplace_back(lane.Ms, lane.ir);
+      const auto beg = hist + std::min(n, t * len);
+      const auto end = hist + std::min(n, (t + 1) * len);
+      if (beg != end) thrd.emplace_back(compress_chunk, t, beg, end);
+    }
+    for (auto& t : thrd) t.join();
+
+    for (size_t j = 0; j != jobs.size(); ++j)
+      for (size_t l = 0; l != jobs[j].lanes->size(); ++l) {
+        auto& lane = (*jobs[j].lanes)[l];
+        for (uint64_t t = 0; t != nChunks; ++t) {
+          auto& wLane = work[t][j][l];
+          lane.sumEnt += wLane.sumEnt;
+          lane.symsNo += wLane.symsNo;
+          lane.entropies.insert(std::end(lane.entropies),
+                                std::begin(wLane.entropies),
+                                std::end(wLane.entropies));
         }
-        update_ctx_ir0(ctx, &prob_par);
-        } else if (rMs[0].ir == 1) {
-          if (c != 'N') {
-            prob_par.config_ir1(c, ctxIr);
-            if (sample_taken) {
-              auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(
-                  cont, prob_par.shl, prob_par.r);
-              entr = entropy(std::begin(f), &prob_par);
-            }
-          } else {
-            // c = TAR_ALT_N;//todo
-            prob_par.config_ir1(c, ctxIr);
-            entr = entropyN;
-          }
-          update_ctx_ir1(ctxIr, &prob_par);
-        } else if (rMs[0].ir == 2) {
-          if (c != 'N') {
-            prob_par.config_ir2(c, ctx, ctxIr);
-            if (sample_taken) {
-              auto f =
-                  freqs_ir2<decltype(2 * (*cont)->query(0))>(cont,
-                  &prob_par);
-              entr = entropy(std::begin(f), &prob_par);
-            }
-          } else {
-            // c = TAR_ALT_N;//todo
-            prob_par.config_ir2(c, ctx, ctxIr);
-            entr = entropyN;
-          }
-          update_ctx_ir2(ctx, ctxIr, &prob_par);
+        lane.write_entropies();
       }
 
+    idx += n;
+    hist = std::min(warm, static_cast<uint64_t>(seq.size()));
+    if (par->verbose)
+      std::cerr << par->message << "[" << (idx * 100) / totalSize << "%]\r";
+  }
+}
+
+inline void FCM::init_lane_1(Lane& lane) const {
+  lane.ctx = 0;  // Ctx, Mir (int) sliding through the dataset
+  lane.ctxIr = (1ull << (2 * rMs[0].k)) - 1;
+  lane.pp = ProbPar{rMs[0].alpha, lane.ctxIr /* mask: 1<<2k-1=4^k-1 */,
+                    static_cast<uint8_t>(rMs[0].k << 1u)};
+}
+
+inline void FCM::init_lane_n(Lane& lane) const {
+  lane.cp.init(lane.Ms);
+}
+
+// Entropy of a symbol of the target, with 1 model. Only computed if sampled
+template <typename ContIter>
+inline prc_t FCM::compress_1_sym(ContIter cont, Lane& lane, char c,
+                                 bool sample_taken) const {
+  auto& prob_par = lane.pp;
+  prc_t entr{0};
+  if (lane.ir == 0) {  // Branch prediction: 1 miss, totalSize-1 hits
+    if (c != 'N') {
+      prob_par.config_ir0(c, lane.ctx);
       if (sample_taken) {
-        ++symsNo;
-        sumEnt += entr;
-        entropies.push_back(entr);
+        auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, prob_par.l);
+        entr = entropy(std::begin(f), &prob_par);
       }
-      ++sample_step_index;
-      // prf_file << precision(PREC_PRF, entr) << '\n';
-      if (par->verbose) show_progress(symsNo, totalSize, par->message);
+    } else {
+      // c = TAR_ALT_N;//todo
+      prob_par.config_ir0(c, lane.ctx);
+      entr = entropyN;
     }
-
-    if (entropies.size() >= FILE_WRITE_BUF) {
-      write_entropies();
-      entropies.clear();
-      entropies.reserve(FILE_WRITE_BUF);
+    update_ctx_ir0(lane.ctx, &prob_par);
+  } else if (lane.ir == 1) {
+    if (c != 'N') {
+      prob_par.config_ir1(c, lane.ctxIr);
+      if (sample_taken) {
+        auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(
+            cont, prob_par.shl, prob_par.r);
+        entr = entropy(std::begin(f), &prob_par);
+      }
+    } else {
+      // c = TAR_ALT_N;//todo
+      prob_par.config_ir1(c, lane.ctxIr);
+      entr = entropyN;
     }
+    update_ctx_ir1(lane.ctxIr, &prob_par);
+  } else if (lane.ir == 2) {
+    if (c != 'N') {
+      prob_par.config_ir2(c, lane.ctx, lane.ctxIr);
+      if (sample_taken) {
+        auto f = freqs_ir2<decltype(2 * (*cont)->query(0))>(cont, &prob_par);
+        entr = entropy(std::begin(f), &prob_par);
+      }
+    } else {
+      // c = TAR_ALT_N;//todo
+      prob_par.config_ir2(c, lane.ctx, lane.ctxIr);
+      entr = entropyN;
+    }
+    update_ctx_ir2(lane.ctx, lane.ctxIr, &prob_par);
   }
-  write_entropies();
-
-  tar_file.close();
-  prf_file.close();
-  aveEnt = sumEnt / symsNo;
-}
-
-void FCM::compress_n(std::unique_ptr<Param>& par) {
-  uint64_t symsNo{0};  // No. syms in target file, except \n
-  prc_t sumEnt{0};     // Sum of entropies = sum(log_2 P(s|c^t))
-  auto cp = std::make_unique<CompressPar>();
-  const auto nMdl = static_cast<uint8_t>(rMs.size()) + rTMsSize;
-  cp->nMdl = nMdl;
-  // Ctx, Mir (int) sliding through the dataset
-  cp->ctx.resize(nMdl);  // Fill with zeros (resize)
-  cp->ctxIr.reserve(nMdl);
-  for (const auto& mm : rMs) {  // Mask: 1<<2k - 1 = 4^k - 1
-    cp->ctxIr.push_back((1ull << (2 * mm.k)) - 1);
-    if (mm.child) cp->ctxIr.push_back((1ull << (2 * mm.k)) - 1);
-  }
-  cp->w.resize(nMdl, static_cast<prc_t>(1) / nMdl);
-  cp->wNext.resize(nMdl, static_cast<prc_t>(0));
-  cp->pp.reserve(nMdl);
-  auto maskIter = std::begin(cp->ctxIr);
-  for (const auto& mm : rMs) {
-    cp->pp.emplace_back(mm.alpha, *maskIter++, static_cast<uint8_t>(2 * mm.k));
-    if (mm.child)
-      cp->pp.emplace_back(mm.child->alpha, *maskIter++,
-                          static_cast<uint8_t>(2 * mm.k));
+  return entr;
+}
+
+// Call "f" with the pipeline of the models "Ms", bound to their containers
+template <typename F>
+void FCM::with_pipeline(const std::vector<MMPar>& Ms, F f) const {
+  PipelineLvl2 p2;
+  PipelineLvl3 p3;
+  PipelineLvl4 p4;
+  PipelineLvl56 p56;
+  PipelineLvl4B p4b;
+  PipelineLvl56B p56b;
+  PipelineLvl4H p4h;
+  PipelineLvl56H p56h;
+  PipelineLvl2P p2p;
+  PipelineLvl4P p4p;
+  PipelineLvl56P p56p;
+  if (bind(p2, Ms))
+    f(p2);
+  else if (bind(p3, Ms))
+    f(p3);
+  else if (bind(p4, Ms))
+    f(p4);
+  else if (bind(p56, Ms))
+    f(p56);
+  else if (bind(p4b, Ms))
+    f(p4b);
+  else if (bind(p56b, Ms))
+    f(p56b);
+  else if (bind(p4h, Ms))
+    f(p4h);
+  else if (bind(p56h, Ms))
+    f(p56h);
+  else if (bind(p2p, Ms))
+    f(p2p);
+  else if (bind(p4p, Ms))
+    f(p4p);
+  else if (bind(p56p, Ms))
+    f(p56p);
+  else
+    f(AnyPipeline{});
+}
+
+template <typename... Stages>
+bool FCM::bind(Pipeline<Stages...>& pipe,
+               const std::vector<MMPar>& Ms) const {
+  if (Ms.size() != sizeof...(Stages)) return false;
+  return bind_impl(pipe, Ms, std::index_sequence_for<Stages...>{});
+}
+
+template <typename... Stages, size_t... I>
+bool FCM::bind_impl(Pipeline<Stages...>& pipe, const std::vector<MMPar>& Ms,
+                    std::index_sequence<I...>) const {
+  std::array<size_t, CONT_KINDS> nKind{};  // No. models bound, per container
+  bool ok{true};
+  using expand = int[];
+  (void)expand{0, (ok = ok && bind_stage<Stages>(std::get<I>(pipe.conts), Ms[I],
+                                                Ms[0].ir, nKind),
+                   0)...};
+  return ok;
+}
+
+// Models are bound in order, each to the next container of its type, as
+// compress_n used to walk them. The IR must be the same for all
+template <typename S>
+bool FCM::bind_stage(const std::unique_ptr<typename S::cont_t>*& cont,
+                     const MMPar& mm, uint8_t ir,
+                     std::array<size_t, CONT_KINDS>& nKind) const {
+  using Cont = typename S::cont_t;
+  if (mm.cont != cont_kind<Cont>() || static_cast<bool>(mm.child) != S::tm ||
+      mm.ir != ir || (mm.child && mm.child->ir != ir))
+    return false;
+  cont = conts(static_cast<const Cont*>(nullptr)) +
+         nKind[static_cast<size_t>(mm.cont)]++;
+  return true;
+}
+
+// Entropy of a symbol by mixing the models, with a pipeline. With "Self",
+// the models also learn the symbol (self compression)
+template <bool Self, typename... Stages>
+inline prc_t FCM::mix_symbol(CompressPar& cp,
+                             const Pipeline<Stages...>& pipe,
+                             const std::vector<MMPar>& Ms, uint8_t ir,
+                             char c) const {
+  switch (ir) {
+    case 0:
+      return mix_pipeline<0, Self>(cp, pipe, Ms.data(), c);
+    case 1:
+      return mix_pipeline<1, Self>(cp, pipe, Ms.data(), c);
+    default:
+      return mix_pipeline<2, Self>(cp, pipe, Ms.data(), c);
   }
-  std::ifstream tar_file(par->tar);
-  std::ofstream prf_file(
-      gen_name(par->ID, par->ref, par->tar, Format::profile));
-  const auto totalSize = file_size(par->tar);
-  std::vector<prc_t> entropies;
-  entropies.reserve(FILE_WRITE_BUF);
-  auto write_entropies = [&]() {
-    for (auto e : entropies) prf_file << precision(PREC_PRF, e) << '\n';
-  };
-  uint64_t sample_step_index = 0;
-
-  const auto compress_n_impl = [&](auto& cp, auto cont, uint8_t& n) {
-    compress_n_parent(cp, cont, n);
-    if (cp->mm.child) {
-      ++cp->ppIt;
-      ++cp->ctxIt;
-      ++cp->ctxIrIt;
-      compress_n_child(cp, cont, ++n);
+}
+
+// Entropy of a symbol by mixing the models, with any models
+template <bool Self>
+inline prc_t FCM::mix_symbol(CompressPar& cp,
+                             const AnyPipeline&, const std::vector<MMPar>& Ms,
+                             uint8_t, char c) const {
+  cp.c = c;
+  cp.nSym = base_code(c);
+  cp.ppIt = cp.pp.data();
+  cp.ctxIt = cp.ctx.data();
+  cp.ctxIrIt = cp.ctxIr.data();
+  auto tbl64_it = std::begin(tbl64);
+  auto tbl32_it = std::begin(tbl32);
+  auto tbl16_it = std::begin(tbl16);
+  auto lgtbl8_it = std::begin(lgtbl8);
+  auto cmls4_it = std::begin(cmls4);
+  auto bcmls4_it = std::begin(bcmls4);
+  auto hshtbl16_it = std::begin(hshtbl16);
+
+  uint8_t n = 0;  // Counter for the models
+  for (const auto& mm : Ms) {
+    switch (mm.cont) {
+      case Container::sketch_8:
+        mix_any<Self>(cp, mm, cmls4_it++, n);
+        break;
+      case Container::block_sketch_8:
+        mix_any<Self>(cp, mm, bcmls4_it++, n);
+        break;
+      case Container::hash_table_16:
+        mix_any<Self>(cp, mm, hshtbl16_it++, n);
+        break;
+      case Container::log_table_8:
+        mix_any<Self>(cp, mm, lgtbl8_it++, n);
+        break;
+      case Container::table_32:
+        mix_any<Self>(cp, mm, tbl32_it++, n);
+        break;
+      case Container::table_16:
+        mix_any<Self>(cp, mm, tbl16_it++, n);
+        break;
+      case Container::table_64:
+        mix_any<Self>(cp, mm, tbl64_it++, n);
+        break;
     }
-  };
+    n += mm.child ? 2 : 1;
+    ++cp.ppIt;
+    ++cp.ctxIt;
+    ++cp.ctxIrIt;
+  }
 
-  for (std::vector<char> buffer(FILE_READ_BUF, 0); tar_file.peek() != EOF;) {
-    tar_file.read(buffer.data(), FILE_READ_BUF);
-    for (auto it = std::begin(buffer);
-         it != std::begin(buffer) + tar_file.gcount(); ++it) {
-      const auto c = *it;
-      if (c == '\n') continue;
-
-      bool sample_taken = (sample_step_index % par->sampleStep == 0);
-      cp->c = c;
-      cp->nSym = base_code(c);
-      cp->ppIt = std::begin(cp->pp);
-      cp->ctxIt = std::begin(cp->ctx);
-      cp->ctxIrIt = std::begin(cp->ctxIr);
-      cp->probs.clear();
-      cp->probs.reserve(nMdl);
-      auto tbl64_it = std::begin(tbl64);
-      auto tbl32_it = std::begin(tbl32);
-      auto lgtbl8_it = std::begin(lgtbl8);
-      auto cmls4_it = std::begin(cmls4);
-
-      uint8_t n = 0;  // Counter for the models
-      for (const auto& mm : rMs) {
-        cp->mm = mm;
-        switch (mm.cont) {
-          case Container::sketch_8:
-            compress_n_impl(cp, cmls4_it++, n);
-            break;
-          case Container::log_table_8:
-            compress_n_impl(cp, lgtbl8_it++, n);
-            break;
-          case Container::table_32:
-            compress_n_impl(cp, tbl32_it++, n);
-            break;
-          case Container::table_64:
-            compress_n_impl(cp, tbl64_it++, n);
-            break;
-        }
-        ++n;
-        ++cp->ppIt;
-        ++cp->ctxIt;
-        ++cp->ctxIrIt;
-      }
+  return mix_entropy(cp);
+}
 
-      const auto entr = entropy(std::begin(cp->w), std::begin(cp->probs),
-                                std::end(cp->probs));
-      // prf_file << precision(PREC_PRF, entr) << '\n';
-      normalize(std::begin(cp->w), std::begin(cp->wNext), std::end(cp->wNext));
-      ////        update_weights(begin(cp->w), begin(cp->probs),
-      /// end(cp->probs));
-      ++symsNo;
-      sumEnt += entr;
-      if (sample_taken) entropies.push_back(entr);
-      ++sample_step_index;
-      if (par->verbose) show_progress(symsNo, totalSize, par->message);
-    }
+template <uint8_t IR, bool Self, typename... Stages>
+inline prc_t FCM::mix_pipeline(CompressPar& cp,
+                               const Pipeline<Stages...>& pipe,
+                               const MMPar* Ms, char c) const {
+  cp.c = c;
+  cp.nSym = base_code(c);
+  mix_stages<IR, Self, 0, 0>(cp, pipe, Ms, std::false_type{});
+  return mix_entropy(cp);
+}
 
-    if (entropies.size() >= FILE_WRITE_BUF) {
-      write_entropies();
-      entropies.clear();
-      entropies.reserve(FILE_WRITE_BUF);
-    }
+// Stage I of the pipeline, whose model is the N-th of the mixture
+template <uint8_t IR, bool Self, size_t I, uint8_t N, typename... Stages>
+inline void FCM::mix_stages(CompressPar& cp,
+                            const Pipeline<Stages...>& pipe, const MMPar* Ms,
+                            std::false_type) const {
+  using S = typename std::tuple_element<I, std::tuple<Stages...>>::type;
+  cp.ppIt = cp.pp.data() + N;
+  cp.ctxIt = cp.ctx.data() + N;
+  cp.ctxIrIt = cp.ctxIr.data() + N;
+  mix<IR, Self, S::tm>(cp, Ms[I], std::get<I>(pipe.conts), N);
+  mix_stages<IR, Self, I + 1, N + (S::tm ? 2 : 1)>(
+      cp, pipe, Ms, std::integral_constant<bool, I + 1 == sizeof...(Stages)>{});
+}
+
+template <uint8_t IR, bool Self, size_t I, uint8_t N, typename... Stages>
+inline void FCM::mix_stages(CompressPar&,
+                            const Pipeline<Stages...>&, const MMPar*,
+                            std::true_type) const {}
+
+template <bool Self, typename ContIter>
+inline void FCM::mix_any(CompressPar& cp, const MMPar& mm,
+                         ContIter cont, uint8_t n) const {
+  switch (mm.ir) {
+    case 0:
+      mm.child ? mix<0, Self, true>(cp, mm, cont, n)
+               : mix<0, Self, false>(cp, mm, cont, n);
+      break;
+    case 1:
+      mm.child ? mix<1, Self, true>(cp, mm, cont, n)
+               : mix<1, Self, false>(cp, mm, cont, n);
+      break;
+    case 2:
+      mm.child ? mix<2, Self, true>(cp, mm, cont, n)
+               : mix<2, Self, false>(cp, mm, cont, n);
+      break;
   }
-  write_entropies();
+}
 
-  tar_file.close();
-  prf_file.close();
-  aveEnt = sumEnt / symsNo;
+// The n-th model of the mixture, followed by its tolerant model if "TM". The
+// IR of a tolerant model is that of its model (application::set_ir, Lane)
+template <uint8_t IR, bool Self, bool TM, typename ContIter>
+inline void FCM::mix(CompressPar& cp, const MMPar& mm,
+                     ContIter cont, uint8_t n) const {
+  uint64_t valUpd = 0;
+  if (Self)
+    self_compress_n_parent<IR>(cp, mm, cont, n, valUpd);
+  else
+    compress_n_parent<IR>(cp, mm, cont, n);
+  if (TM) {
+    ++cp.ppIt;
+    ++cp.ctxIt;
+    ++cp.ctxIrIt;
+    compress_n_child<IR>(cp, mm.child.get(), cont, n + 1);
+  }
+  if (Self) (*cont)->update(valUpd);
 }
 
-template <typename ContIter>
-inline void FCM::compress_n_parent(std::unique_ptr<CompressPar>& cp,
-                                   ContIter cont, uint8_t n) const {
+inline prc_t FCM::mix_entropy(CompressPar& cp) const {
+  const auto entr = entropy(std::begin(cp.w), std::begin(cp.probs),
+                            std::begin(cp.probs) + cp.nMdl);
+  normalize(std::begin(cp.w), std::begin(cp.wNext),
+            std::begin(cp.wNext) + cp.nMdl);
+  ////  update_weights(begin(cp.w), begin(cp.probs), end(cp.probs));
+  return entr;
+}
+
+template <uint8_t IR, typename ContIter>
+inline void FCM::compress_n_parent(CompressPar& cp,
+                                   const MMPar& mm, ContIter cont,
+                                   uint8_t n) const {
   prc_t prb;
 
-  if (cp->mm.ir == 0) {
-    if (cp->c != 'N') {
-      cp->ppIt->config_ir0(cp->c, *cp->ctxIt);
-      auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, cp->ppIt->l);
-      prb = prob(std::begin(f), cp->ppIt);
+  if (IR == 0) {
+    if (cp.c != 'N') {
+      cp.ppIt->config_ir0(cp.c, *cp.ctxIt);
+      auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, cp.ppIt->l);
+      prb = prob(std::begin(f), cp.ppIt);
     } else {
-      // cp->c = TAR_ALT_N;//todo
-      cp->ppIt->config_ir0(cp->c, *cp->ctxIt);
+      // cp.c = TAR_ALT_N;//todo
+      cp.ppIt->config_ir0(cp.c, *cp.ctxIt);
       prb = 1.0 / std::pow(2.0, entropyN);
     }
-    cp->probs.push_back(prb);
-    cp->wNext[n] = weight_next(cp->w[n], cp->mm.gamma, prb);
-    update_ctx_ir0(*cp->ctxIt, cp->ppIt);
-  } else if (cp->mm.ir == 1) {
-    if (cp->c != 'N') {
-      cp->ppIt->config_ir1(cp->c, *cp->ctxIrIt);
-      auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(cont, cp->ppIt->shl,
-                                                          cp->ppIt->r);
-      prb = prob(std::begin(f), cp->ppIt);
+    cp.probs[n] = prb;
+    cp.wNext[n] = weight_next(cp.w[n], mm.gamma, prb);
+    update_ctx_ir0(*cp.ctxIt, cp.ppIt);
+  } else if (IR == 1) {
+    if (cp.c != 'N') {
+      cp.ppIt->config_ir1(cp.c, *cp.ctxIrIt);
+      auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(cont, cp.ppIt->shl,
+                                                          cp.ppIt->r);
+      prb = prob(std::begin(f), cp.ppIt);
     } else {
-      // cp->c = TAR_ALT_N;//todo
-      cp->ppIt->config_ir1(cp->c, *cp->ctxIrIt);
+      // cp.c = TAR_ALT_N;//todo
+      cp.ppIt->config_ir1(cp.c, *cp.ctxIrIt);
       prb = 1.0 / std::pow(2.0, entropyN);
     }
-    cp->probs.push_back(prb);
-    cp->wNext[n] = weight_next(cp->w[n], cp->mm.gamma, prb);
-    update_ctx_ir1(*cp->ctxIrIt, cp->ppIt);
-  } else if (cp->mm.ir == 2) {
-    if (cp->c != 'N') {
-      cp->ppIt->config_ir2(cp->c, *cp->ctxIt, *cp->ctxIrIt);
-      auto f = freqs_ir2<decltype(2 * (*cont)->query(0))>(cont, cp->ppIt);
-      prb = prob(std::begin(f), cp->ppIt);
+    cp.probs[n] = prb;
+    cp.wNext[n] = weight_next(cp.w[n], mm.gamma, prb);
+    update_ctx_ir1(*cp.ctxIrIt, cp.ppIt);
+  } else if (IR == 2) {
+    if (cp.c != 'N') {
+      cp.ppIt->config_ir2(cp.c, *cp.ctxIt, *cp.ctxIrIt);
+      auto f = freqs_ir2<decltype(2 * (*cont)->query(0))>(cont, cp.ppIt);
+      prb = prob(std::begin(f), cp.ppIt);
     } else {
-      // cp->c = TAR_ALT_N;//todo
-      cp->ppIt->config_ir2(cp->c, *cp->ctxIt, *cp->ctxIrIt);
+      // cp.c = TAR_ALT_N;//todo
+      cp.ppIt->config_ir2(cp.c, *cp.ctxIt, *cp.ctxIrIt);
       prb = 1.0 / std::pow(2.0, entropyN);
     }
-    cp->probs.push_back(prb);
-    cp->wNext[n] = weight_next(cp->w[n], cp->mm.gamma, prb);
-    update_ctx_ir2(*cp->ctxIt, *cp->ctxIrIt, cp->ppIt);
+    cp.probs[n] = prb;
+    cp.wNext[n] = weight_next(cp.w[n], mm.gamma, prb);
+    update_ctx_ir2(*cp.ctxIt, *cp.ctxIrIt, cp.ppIt);
   }
 }
 
-template <typename ContIter>
-inline void FCM::compress_n_child(std::unique_ptr<CompressPar>& cp,
-                                  ContIter cont, uint8_t n) const {
+template <uint8_t IR, typename ContIter>
+inline void FCM::compress_n_child(CompressPar& cp,
+                                  STMMPar* stmm, ContIter cont,
+                                  uint8_t n) const {
   prc_t prb;
 
-  if (cp->mm.child->ir == 0) {
-    if (cp->c != 'N') {
-      cp->ppIt->config_ir0(cp->c, *cp->ctxIt);  // l
-      auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, cp->ppIt->l);
-      prb = prob(std::begin(f), cp->ppIt);
-      cp->probs.push_back(prb);
-      correct_stmm(cp, std::begin(f));
+  if (IR == 0) {
+    if (cp.c != 'N') {
+      cp.ppIt->config_ir0(cp.c, *cp.ctxIt);  // l
+      auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, cp.ppIt->l);
+      prb = prob(std::begin(f), cp.ppIt);
+      cp.probs[n] = prb;
+      correct_stmm<IR>(cp, stmm, std::begin(f));
     } else {
-      // cp->c = TAR_ALT_N;//todo
-      cp->ppIt->config_ir0(cp->c, *cp->ctxIt);  // l
-      auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, cp->ppIt->l);
+      // cp.c = TAR_ALT_N;//todo
+      cp.ppIt->config_ir0(cp.c, *cp.ctxIt);  // l
+      auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, cp.ppIt->l);
       prb = 1.0 / std::pow(2.0, entropyN);
-      cp->probs.push_back(prb);
-      correct_stmm(cp, std::begin(f));
+      cp.probs[n] = prb;
+      correct_stmm<IR>(cp, stmm, std::begin(f));
     }
-    cp->wNext[n] = weight_next(cp->w[n], cp->mm.child->gamma, prb);
-    update_ctx_ir0(*cp->ctxIt, cp->ppIt);
-  } else if (cp->mm.child->ir == 1) {
-    if (cp->c != 'N') {
-      cp->ppIt->config_ir1(cp->c, *cp->ctxIrIt);  // r
-      auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(cont, cp->ppIt->shl,
-                                                          cp->ppIt->r);
-      prb = prob(std::begin(f), cp->ppIt);
-      cp->probs.push_back(prb);
-      correct_stmm(cp, std::begin(f));
+    cp.wNext[n] = weight_next(cp.w[n], stmm->gamma, prb);
+    update_ctx_ir0(*cp.ctxIt, cp.ppIt);
+  } else if (IR == 1) {
+    if (cp.c != 'N') {
+      cp.ppIt->config_ir1(cp.c, *cp.ctxIrIt);  // r
+      auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(cont, cp.ppIt->shl,
+                                                          cp.ppIt->r);
+      prb = prob(std::begin(f), cp.ppIt);
+      cp.probs[n] = prb;
+      correct_stmm<IR>(cp, stmm, std::begin(f));
     } else {
-      // cp->c = TAR_ALT_N;//todo
-      cp->ppIt->config_ir1(cp->c, *cp->ctxIrIt);  // r
-      auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(cont, cp->ppIt->shl,
-                                                          cp->ppIt->r);
+      // cp.c = TAR_ALT_N;//todo
+      cp.ppIt->config_ir1(cp.c, *cp.ctxIrIt);  // r
+      auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(cont, cp.ppIt->shl,
+                                                          cp.ppIt->r);
       prb = 1.0 / std::pow(2.0, entropyN);
-      cp->probs.push_back(prb);
-      correct_stmm(cp, std::begin(f));
+      cp.probs[n] = prb;
+      correct_stmm<IR>(cp, stmm, std::begin(f));
     }
-    cp->wNext[n] = weight_next(cp->w[n], cp->mm.child->gamma, prb);
-    update_ctx_ir1(*cp->ctxIrIt, cp->ppIt);
-  } else if (cp->mm.child->ir == 2) {
-    if (cp->c != 'N') {
-      cp->ppIt->config_ir2(cp->c, *cp->ctxIt, *cp->ctxIrIt);  // l and r
-      auto f = freqs_ir2<decltype(2 * (*cont)->query(0))>(cont, cp->ppIt);
-      prb = prob(std::begin(f), cp->ppIt);
-      cp->probs.push_back(prb);
-      correct_stmm(cp, std::begin(f));
+    cp.wNext[n] = weight_next(cp.w[n], stmm->gamma, prb);
+    update_ctx_ir1(*cp.ctxIrIt, cp.ppIt);
+  } else if (IR == 2) {
+    if (cp.c != 'N') {
+      cp.ppIt->config_ir2(cp.c, *cp.ctxIt, *cp.ctxIrIt);  // l and r
+      auto f = freqs_ir2<decltype(2 * (*cont)->query(0))>(cont, cp.ppIt);
+      prb = prob(std::begin(f), cp.ppIt);
+      cp.probs[n] = prb;
+      correct_stmm<IR>(cp, stmm, std::begin(f));
     } else {
-      // cp->c = TAR_ALT_N;//todo
-      cp->ppIt->config_ir2(cp->c, *cp->ctxIt, *cp->ctxIrIt);  // l and r
-      auto f = freqs_ir2<decltype(2 * (*cont)->query(0))>(cont, cp->ppIt);
+      // cp.c = TAR_ALT_N;//todo
+      cp.ppIt->config_ir2(cp.c, *cp.ctxIt, *cp.ctxIrIt);  // l and r
+      auto f = freqs_ir2<decltype(2 * (*cont)->query(0))>(cont, cp.ppIt);
       prb = 1.0 / std::pow(2.0, entropyN);
-      cp->probs.push_back(prb);
-      correct_stmm(cp, std::begin(f));
+      cp.probs[n] = prb;
+      correct_stmm<IR>(cp, stmm, std::begin(f));
     }
-    cp->wNext[n] = weight_next(cp->w[n], cp->mm.child->gamma, prb);
-    update_ctx_ir2(*cp->ctxIt, *cp->ctxIrIt, cp->ppIt);
+    cp.wNext[n] = weight_next(cp.w[n], stmm->gamma, prb);
+    update_ctx_ir2(*cp.ctxIt, *cp.ctxIrIt, cp.ppIt);
   }
 }
 
-void FCM::self_compress(std::unique_ptr<Param>& par, uint64_t ID,
-                        uint8_t round) {
+// Returns the average entropy of the segment
+prc_t FCM::self_compress(std::unique_ptr<Param>& par, uint64_t ID,
+                         uint8_t round) {
   std::string message;
   if (par->verbose) {
     if (round == 3)
@@ -808,70 +1602,60 @@ void FCM::self_compress(std::unique_ptr<Param>& par, uint64_t ID,
       message = "    [-] Compressing segment " + std::to_string(ID + 1) + " ";
   }
 
-  self_compress_alloc();
+  self_compress_alloc(par->pages, par->views->size(par->seq));
 
+  prc_t ent{0};
   if (tMs.size() == 1 && tTMsSize == 0)  // 1 MM
     switch (tMs[0].cont) {
       case Container::sketch_8:
-        self_compress_1(par, std::begin(cmls4), ID);
+        ent = self_compress_1(par, std::begin(cmls4));
+        break;
+      case Container::block_sketch_8:
+        ent = self_compress_1(par, std::begin(bcmls4));
+        break;
+      case Container::hash_table_16:
+        ent = self_compress_1(par, std::begin(hshtbl16));
         break;
       case Container::log_table_8:
-        self_compress_1(par, std::begin(lgtbl8), ID);
+        ent = self_compress_1(par, std::begin(lgtbl8));
         break;
       case Container::table_32:
-        self_compress_1(par, std::begin(tbl32), ID);
+        ent = self_compress_1(par, std::begin(tbl32));
+        break;
+      case Container::table_16:
+        ent = self_compress_1(par, std::begin(tbl16));
         break;
       case Container::table_64:
-        self_compress_1(par, std::begin(tbl64), ID);
+        ent = self_compress_1(par, std::begin(tbl64));
         break;
     }
   else
-    self_compress_n(par, ID);
+    ent = self_compress_n(par);
 
   if (par->verbose)
     std::cerr << "\r" << message << "done. Ave. entropy = "
-              << fixed_precision(PREC_PRF, selfEnt[ID]) << " bps." << '\n';
+              << fixed_precision(PREC_PRF, ent) << " bps." << '\n';
+  return ent;
 }
 
-inline void FCM::self_compress_alloc() {
-  for (auto& e : cmls4) e.reset();
-  for (auto& e : lgtbl8) e.reset();
-  for (auto& e : tbl32) e.reset();
-  for (auto& e : tbl64) e.reset();
-  cmls4.clear();
-  lgtbl8.clear();
-  tbl32.clear();
-  tbl64.clear();
-
-  for (const auto& m : tMs) {
-    switch (m.cont) {
-      case Container::sketch_8:
-        cmls4.push_back(std::make_unique<CMLS4>(m.w, m.d));
-        break;
-      case Container::log_table_8:
-        lgtbl8.push_back(std::make_unique<LogTable8>(m.k));
-        break;
-      case Container::table_32:
-        tbl32.push_back(std::make_unique<Table32>(m.k));
-        break;
-      case Container::table_64:
-        tbl64.push_back(std::make_unique<Table64>(m.k));
-        break;
-    }
-  }
+inline void FCM::self_compress_alloc(Pages pages, uint64_t nSyms) {
+  give_back();
+  held = &tMs;
+  for (const auto& m : tMs) add_model(m, pages, nSyms, true);
 }
 
 template <typename ContIter>
-inline void FCM::self_compress_1(std::unique_ptr<Param>& par, ContIter cont,
-                                 uint64_t ID) {
+inline prc_t FCM::self_compress_1(std::unique_ptr<Param>& par,
+                                  ContIter cont) {
   uint64_t ctx{0};
   uint64_t ctxIr{(1ull << (2 * tMs[0].k)) - 1};
   uint64_t symsNo{0};
   prc_t sumEnt{0};
-  std::ifstream seqF(par->seq);
+  const auto seq_in = par->views->open(par->seq);
+  auto& seqF = *seq_in;
   ProbPar pp{tMs[0].alpha, ctxIr /* mask: 1<<2k-1=4^k-1 */,
              static_cast<uint8_t>(tMs[0].k << 1u)};
-  const auto totalSize = file_size(par->seq);
+  const auto totalSize = par->views->size(par->seq);
   prc_t entr;
 
   for (std::vector<char> buffer(FILE_READ_BUF, 0); seqF.peek() != EOF;) {
@@ -923,148 +1707,78 @@ inline void FCM::self_compress_1(std::unique_ptr<Param>& par, ContIter cont,
       }
     }
   }
-  /*mut.lock();*/ selfEnt[ID] = sumEnt / symsNo; /*mut.unlock();*/
-  seqF.close();
+  return sumEnt / symsNo;
 }
 
-inline void FCM::self_compress_n(std::unique_ptr<Param>& par, uint64_t ID) {
+inline prc_t FCM::self_compress_n(std::unique_ptr<Param>& par) {
   uint64_t symsNo{0};
   prc_t sumEnt{0};
-  std::ifstream seqF(par->seq);
-  auto cp = std::make_unique<CompressPar>();
-  const auto nMdl = static_cast<uint8_t>(tMs.size() + tTMsSize);
-  cp->nMdl = nMdl;
-  cp->ctx.resize(nMdl);  // Fill with zeros (resize)
-  cp->ctxIr.reserve(nMdl);
-  for (const auto& mm : tMs) {  // Mask: 1<<2k - 1 = 4^k - 1
-    cp->ctxIr.push_back((1ull << (mm.k << 1)) - 1);
-    if (mm.child) cp->ctxIr.push_back((1ull << (mm.k << 1)) - 1);
-  }
-  cp->w.resize(nMdl, static_cast<prc_t>(1) / nMdl);
-  cp->wNext.resize(nMdl, static_cast<prc_t>(0));
-  cp->pp.reserve(nMdl);
-  auto maskIter = begin(cp->ctxIr);
-  for (const auto& mm : tMs) {
-    cp->pp.emplace_back(mm.alpha, *maskIter++,
-                        static_cast<uint8_t>(mm.k << 1u));
-    if (mm.child)
-      cp->pp.emplace_back(mm.child->alpha, *maskIter++,
-                          static_cast<uint8_t>(mm.k << 1u));
-  }
-  const auto totalSize = file_size(par->seq);
-  const auto self_compress_n_impl = [&](auto& cp, auto cont, uint8_t& n) {
-    uint64_t valUpd = 0;
-    self_compress_n_parent(cp, cont, n, valUpd);
-    if (cp->mm.child) {
-      ++cp->ppIt;
-      ++cp->ctxIt;
-      ++cp->ctxIrIt;
-      compress_n_child(cp, cont, ++n);
-    }
-    (*cont)->update(valUpd);
-  };
-
-  for (std::vector<char> buffer(FILE_READ_BUF, 0); seqF.peek() != EOF;) {
-    seqF.read(buffer.data(), FILE_READ_BUF);
-    for (auto it = std::begin(buffer); it != std::begin(buffer) + seqF.gcount();
-         ++it) {
-      const auto c = *it;
-      if (c != '\n') {
-        ++symsNo;
-        cp->c = c;
-        cp->nSym = base_code(c);
-        cp->ppIt = std::begin(cp->pp);
-        cp->ctxIt = std::begin(cp->ctx);
-        cp->ctxIrIt = std::begin(cp->ctxIr);
-        cp->probs.clear();
-        cp->probs.reserve(nMdl);
-        auto tbl64_it = std::begin(tbl64);
-        auto tbl32_it = std::begin(tbl32);
-        auto lgtbl8_it = std::begin(lgtbl8);
-        auto cmls4_it = std::begin(cmls4);
-
-        uint8_t n = 0;  // Counter for the models
-        for (const auto& mm : tMs) {
-          cp->mm = mm;
-          switch (mm.cont) {
-            case Container::sketch_8:
-              self_compress_n_impl(cp, cmls4_it++, n);
-              break;
-            case Container::log_table_8:
-              self_compress_n_impl(cp, lgtbl8_it++, n);
-              break;
-            case Container::table_32:
-              self_compress_n_impl(cp, tbl32_it++, n);
-              break;
-            case Container::table_64:
-              self_compress_n_impl(cp, tbl64_it++, n);
-              break;
-          }
-          ++n;
-          ++cp->ppIt;
-          ++cp->ctxIt;
-          ++cp->ctxIrIt;
+  const auto seq_in = par->views->open(par->seq);
+  auto& seqF = *seq_in;
+  CompressPar cp;
+  cp.init(tMs);
+  const auto totalSize = par->views->size(par->seq);
+
+  with_pipeline(tMs, [&](const auto& pipe) {
+    for (std::vector<char> buffer(FILE_READ_BUF, 0); seqF.peek() != EOF;) {
+      seqF.read(buffer.data(), FILE_READ_BUF);
+      for (auto it = std::begin(buffer);
+           it != std::begin(buffer) + seqF.gcount(); ++it) {
+        const auto c = *it;
+        if (c != '\n') {
+          ++symsNo;
+          sumEnt += mix_symbol<true>(cp, pipe, tMs, tMs[0].ir, c);
+          if (par->verbose) show_progress(symsNo, totalSize, par->message);
         }
-
-        const auto ent = entropy(std::begin(cp->w), std::begin(cp->probs),
-                                 std::end(cp->probs));
-        // cout << precision(PREC_PRF, ent) << '\n';
-        normalize(std::begin(cp->w), std::begin(cp->wNext),
-                  std::end(cp->wNext));
-        ////        update_weights(begin(cp->w), begin(cp->probs),
-        /// end(cp->probs));
-        sumEnt += ent;
-        if (par->verbose) show_progress(symsNo, totalSize, par->message);
       }
     }
-  }
-  /*mut.lock();*/ selfEnt[ID] = sumEnt / symsNo; /*mut.unlock();*/
-  seqF.close();
+  });
+  return sumEnt / symsNo;
 }
 
-template <typename ContIter>
-inline void FCM::self_compress_n_parent(std::unique_ptr<CompressPar>& cp,
-                                        ContIter cont, uint8_t n,
-                                        uint64_t& valUpd) const {
+template <uint8_t IR, typename ContIter>
+inline void FCM::self_compress_n_parent(CompressPar& cp,
+                                        const MMPar& mm, ContIter cont,
+                                        uint8_t n, uint64_t& valUpd) const {
   prc_t prb;
 
-  if (cp->mm.ir == 0) {
-    cp->ppIt->config_ir0(cp->c, *cp->ctxIt);
-    if (cp->c != 'N') {
-      auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, cp->ppIt->l);
-      prb = prob(begin(f), cp->ppIt);
+  if (IR == 0) {
+    cp.ppIt->config_ir0(cp.c, *cp.ctxIt);
+    if (cp.c != 'N') {
+      auto f = freqs_ir0<decltype((*cont)->query(0))>(cont, cp.ppIt->l);
+      prb = prob(begin(f), cp.ppIt);
     } else {
       prb = 1.0 / std::pow(2.0, entropyN);
     }
-    cp->probs.push_back(prb);
-    cp->wNext[n] = weight_next(cp->w[n], cp->mm.gamma, prb);
-    valUpd = cp->ppIt->l | cp->ppIt->numSym;
-    update_ctx_ir0(*cp->ctxIt, cp->ppIt);
-  } else if (cp->mm.ir == 1) {
-    cp->ppIt->config_ir1(cp->c, *cp->ctxIrIt);
-    if (cp->c != 'N') {
-      auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(cont, cp->ppIt->shl,
-                                                          cp->ppIt->r);
-      prb = prob(std::begin(f), cp->ppIt);
+    cp.probs[n] = prb;
+    cp.wNext[n] = weight_next(cp.w[n], mm.gamma, prb);
+    valUpd = cp.ppIt->l | cp.ppIt->numSym;
+    update_ctx_ir0(*cp.ctxIt, cp.ppIt);
+  } else if (IR == 1) {
+    cp.ppIt->config_ir1(cp.c, *cp.ctxIrIt);
+    if (cp.c != 'N') {
+      auto f = freqs_ir1<decltype(2 * (*cont)->query(0))>(cont, cp.ppIt->shl,
+                                                          cp.ppIt->r);
+      prb = prob(std::begin(f), cp.ppIt);
     } else {
       prb = 1.0 / std::pow(2.0, entropyN);
     }
-    cp->probs.push_back(prb);
-    cp->wNext[n] = weight_next(cp->w[n], cp->mm.gamma, prb);
-    valUpd = (cp->ppIt->revNumSym << cp->ppIt->shl) | cp->ppIt->r;
-    update_ctx_ir1(*cp->ctxIrIt, cp->ppIt);
-  } else if (cp->mm.ir == 2) {
-    cp->ppIt->config_ir2(cp->c, *cp->ctxIt, *cp->ctxIrIt);
-    if (cp->c != 'N') {
-      auto f = freqs_ir2<decltype(2 * (*cont)->query(0))>(cont, cp->ppIt);
-      prb = prob(std::begin(f), cp->ppIt);
+    cp.probs[n] = prb;
+    cp.wNext[n] = weight_next(cp.w[n], mm.gamma, prb);
+    valUpd = (cp.ppIt->revNumSym << cp.ppIt->shl) | cp.ppIt->r;
+    update_ctx_ir1(*cp.ctxIrIt, cp.ppIt);
+  } else if (IR == 2) {
+    cp.ppIt->config_ir2(cp.c, *cp.ctxIt, *cp.ctxIrIt);
+    if (cp.c != 'N') {
+      auto f = freqs_ir2<decltype(2 * (*cont)->query(0))>(cont, cp.ppIt);
+      prb = prob(std::begin(f), cp.ppIt);
     } else {
       prb = 1.0 / std::pow(2.0, entropyN);
     }
-    cp->probs.push_back(prb);
-    cp->wNext[n] = weight_next(cp->w[n], cp->mm.gamma, prb);
-    valUpd = cp->ppIt->l | cp->ppIt->numSym;
-    update_ctx_ir2(*cp->ctxIt, *cp->ctxIrIt, cp->ppIt);
+    cp.probs[n] = prb;
+    cp.wNext[n] = weight_next(cp.w[n], mm.gamma, prb);
+    valUpd = cp.ppIt->l | cp.ppIt->numSym;
+    update_ctx_ir2(*cp.ctxIt, *cp.ctxIrIt, cp.ppIt);
   }
 }
 
@@ -1114,8 +1828,8 @@ inline prc_t FCM::weight_next(prc_t w, prc_t g, prc_t p) const {
   return Power(w, g) * p;
 }
 
-template <typename FreqIter>
-inline void FCM::correct_stmm(std::unique_ptr<CompressPar>& cp,
+template <uint8_t IR, typename FreqIter>
+inline void FCM::correct_stmm(CompressPar& cp, STMMPar* stmm,
                               FreqIter fFirst) const {
   const auto best_id = [=](FreqIter fFirst) {
     //  if (are_all(fFirst, 0) || are_all(fFirst, 1)) {
@@ -1129,25 +1843,24 @@ inline void FCM::correct_stmm(std::unique_ptr<CompressPar>& cp,
     }
     return static_cast<uint8_t>(maxPos - fFirst);
   };
-  auto stmm = cp->mm.child;
   const auto best = best_id(fFirst);
 
   if (stmm->enabled) {
     if (best == static_cast<uint8_t>(255))
       miss_stmm(stmm);
-    else if (best == static_cast<uint8_t>(254) || best == cp->nSym)
+    else if (best == static_cast<uint8_t>(254) || best == cp.nSym)
       hit_stmm(stmm);
     else {
       miss_stmm(stmm);
-      switch (stmm->ir) {
+      switch (IR) {
         case 0:
-          cp->ppIt->config_ir0(best);
+          cp.ppIt->config_ir0(best);
           break;
         case 1:
-          cp->ppIt->config_ir1(best);
+          cp.ppIt->config_ir1(best);
           break;
         case 2:
-          cp->ppIt->config_ir2(best);
+          cp.ppIt->config_ir2(best);
           break;
         default:
           break;
@@ -1166,16 +1879,16 @@ inline void FCM::correct_stmm(std::unique_ptr<CompressPar>& cp,
 ////template <typename FreqIter>
 ////inline bool FCM::correct_stmm
 ////(unique_ptr<CompressPar>& cp, const FreqIter& fFirst) {
-////  auto stmm = cp->mm.child;
+////  auto stmm = cp.mm.child;
 ////  const auto best = best_id(fFirst);
 ////  if (stmm->enabled) {
 ////    if (best==static_cast<uint8_t>(255))
 ////      miss_stmm(stmm);
-////    else if (best==static_cast<uint8_t>(254) || best==cp->nSym)
+////    else if (best==static_cast<uint8_t>(254) || best==cp.nSym)
 ////      hit_stmm(stmm);
 ////    else {
 ////      miss_stmm(stmm);
-////      stmm->ir==0 ? cp->ppIt->config(best) : cp->ppIt->config_ir(best);
+////      stmm->ir==0 ? cp.ppIt->config(best) : cp.ppIt->config_ir(best);
 ////    }
 ////  }
 ////  else if (!stmm->enabled &&
@@ -1292,8 +2005,8 @@ inline prc_t FCM::entropy(prc_t P) const {
 
 template <typename WIter, typename PIter>
 inline prc_t FCM::entropy(WIter wFirst, PIter PFirst, PIter PLast) const {
-  return std::log2(1 /
-                   inner_product(PFirst, PLast, wFirst, static_cast<prc_t>(0)));
+  return std::log2(
+      1 / std::inner_product(PFirst, PLast, wFirst, static_cast<prc_t>(0)));
   //  return -std::log2(
   //    inner_product(PFirst, PLast, wFirst, static_cast<prc_t>(0)));
 
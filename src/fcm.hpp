@@ -5,18 +5,34 @@
 #ifndef SMASHPP_FCM_HPP
 #define SMASHPP_FCM_HPP
 
+#include <array>
+#include <fstream>
 #include <memory>
+#include <utility>
 
+#include "bcmls4.hpp"
 #include "cmls4.hpp"
+#include "hashtbl16.hpp"
 #include "logtbl8.hpp"
+#include "mdlcache.hpp"
 #include "mdlpar.hpp"
+#include "mdlpool.hpp"
+#include "packseq.hpp"
 #include "par.hpp"
+#include "pipeline.hpp"
+#include "prffile.hpp"
+#include "prfring.hpp"
+#include "tbl16.hpp"
 #include "tbl32.hpp"
 #include "tbl64.hpp"
 
 namespace smashpp {
 static constexpr uint8_t PREC_PRF{3};  // Precisions - floats in Inf. prof
 static constexpr char TAR_ALT_N{'T'};  // Alter. to Ns in target file
+static constexpr uint64_t TAR_CHUNK{1ull << 20};  // Symbols per thread, block
+static constexpr uint64_t PREFETCH_DIST{32};  // Bases looked ahead, store
+static constexpr uint64_t SHARD_SPAN{1ull << 20};  // Bases bucketed at once
+static constexpr uint64_t BATCH_TASKS{64};  // Round 2/3 batch, up to nthr
 
 class FCM {  // Finite-context models
  public:
@@ -27,49 +43,188 @@ class FCM {  // Finite-context models
   uint64_t tarSegID;
   std::string tarSegMsg;
 
-  explicit FCM(std::unique_ptr<Param>&);
+  explicit FCM(std::unique_ptr<Param>&, ModelPool* = nullptr);
+  ~FCM() { give_back(); }
   void store(std::unique_ptr<Param>&, uint8_t);  // Build FCM
-  void compress(std::unique_ptr<Param>&, uint8_t);
-  void self_compress(std::unique_ptr<Param>&, uint64_t, uint8_t);
+  void compress_both(std::unique_ptr<Param>&,
+                     const std::vector<ProfileRing*>&);  // Reg. & inv., 1 pass
+  static void compress_batch(std::vector<std::unique_ptr<Param>>&,
+                             std::vector<std::unique_ptr<FCM>>&, uint8_t,
+                             const std::vector<ProfileRing*>&,
+                             uint8_t);  // Same tar, by nthr threads
+  auto model_bytes(uint64_t) const -> uint64_t;  // Ref models, for n symbols
+  static auto model_bytes(const MMPar&, uint64_t, bool = true)
+      -> uint64_t;  // A model, sparse if it may be
+  static void set_cont(std::unique_ptr<Param>&,
+                       std::vector<MMPar>&);  // Containers, by k
+  auto self_compress(std::unique_ptr<Param>&, uint64_t, uint8_t) -> prc_t;
   void aggregate_slf_ent(std::vector<PosRow>&, uint8_t, uint8_t, std::string,
                          bool) const;
 
  private:
   std::vector<std::unique_ptr<Table64>> tbl64;
   std::vector<std::unique_ptr<Table32>> tbl32;
+  std::vector<std::unique_ptr<Table16>> tbl16;
   std::vector<std::unique_ptr<LogTable8>> lgtbl8;
   std::vector<std::unique_ptr<CMLS4>> cmls4;
+  std::vector<std::unique_ptr<BlockCMLS4>> bcmls4;
+  std::vector<std::unique_ptr<HashTable16>> hshtbl16;
+  std::vector<bool> cached;     // Ref models loaded from the model cache
+  std::vector<size_t> contIdx;  // Index of each ref model in its container
+  ModelPool* pool;  // Where the models come from and go back, if any
+  const std::vector<MMPar>* held;  // rMs or tMs, whose models are allocated
   std::string message;
   prc_t entropyN;
   uint8_t rTMsSize;
   uint8_t tTMsSize;
 
-  void set_cont(std::vector<MMPar>&);
   void show_info(
       std::unique_ptr<Param>&) const;  // Show inputs info on the screen
-  void alloc_model();                  // Allocate memory to models
+  static auto touched(const MMPar&, uint64_t) -> uint64_t;
+  void add_model(const MMPar&, Pages, uint64_t, bool);
+  void give_back();
+  void alloc_model(const ModelCache*, Pages, uint64_t,
+                   bool);  // Allocate memory to models
+  auto is_sparse(size_t) const -> bool;  // Ref model i has sparse counters
+  auto page_info() const -> std::string;  // Pages obtained by the models
+  void save_model(const ModelCache&) const;  // Put new models in cache
 
   void store_1(std::unique_ptr<Param>&);  // Build models one thread
   void store_n(std::unique_ptr<Param>&);  // Build models multiple threads
-  template <typename Mask, typename ContIter>
-  void store_impl(std::string, Mask, ContIter);  // Fill data struct
+  void store_model(const PackedSeq&, size_t, uint64_t&);  // Feed model i
+  void store_model_n(const PackedSeq&, size_t, uint64_t&, uint64_t, uint8_t);
+  template <typename Cont>
+  void store_impl(const PackedSeq&, uint64_t, uint64_t&, Cont&);  // Fill
+  template <typename Cont>
+  void store_impl_n(const PackedSeq&, uint64_t, uint64_t, uint64_t, uint64_t,
+                    uint64_t, Cont&) const;  // A part, concurrently
+  template <typename Cont>
+  void store_shards_n(const PackedSeq&, uint8_t, uint64_t, uint64_t, Cont&,
+                      uint8_t) const;  // A table, by rows
+  struct Bucketed {  // A context of a table, < 4^15, and where in the chunk
+    uint32_t ctx;
+    uint32_t at;
+  };
+  auto ctx_at(const PackedSeq&, uint64_t, uint64_t, uint8_t) const
+      -> uint64_t;  // Context before a position
 
+  // A mode of compression of the target: models, their state and profile
+  struct Lane {
+    std::vector<MMPar> Ms;
+    uint8_t ir;
+    ProfileWriter prf;  // If saved
+    ProfileRing* ring;  // To the filter, if any
+    std::vector<prc_t> entropies;  // Not yet written to the profile
+    prc_t sumEnt;
+    uint64_t symsNo;
+    ProbPar pp;  // compress_1
+    uint64_t ctx;
+    uint64_t ctxIr;
+    CompressPar cp;  // compress_n
+
+    Lane(const std::vector<MMPar>&, uint8_t, ProfileRing* = nullptr);
+    void write_entropies();
+  };
+  void compress_lanes(std::unique_ptr<Param>&, std::vector<Lane>&);
+  void save_profile(std::unique_ptr<Param>&, Lane&) const;  // Name by par
+  struct Block {  // Symbols of the target fed to lanes
+    const char* seq;
+    uint64_t from;  // [from, beg) only warm the models up
+    uint64_t beg;
+    uint64_t end;
+    uint64_t base;  // Index of seq[0] in the target, for sampling
+    uint64_t sampleStep;
+  };
+  struct Job {  // Lanes of an FCM, fed the target
+    const FCM* fcm;
+    std::vector<Lane>* lanes;
+  };
+  static void compress_jobs(std::unique_ptr<Param>&, std::vector<Job>&);
+  static void compress_stream(std::unique_ptr<Param>&,
+                              std::vector<Job>&);  // Jobs by the threads
+  static void compress_chunks(std::unique_ptr<Param>&,
+                              std::vector<Job>&);  // Chunks by the threads
+  static void read_block(std::istream&, std::vector<char>&, uint64_t);
+  void init_lanes(std::vector<Lane>&) const;
+  void feed(std::vector<Lane>&, const Block&) const;
   template <typename ContIter>
-  void compress_1(std::unique_ptr<Param>&, ContIter);  // Compress with 1 model
-  void compress_n(std::unique_ptr<Param>&);            // Compress with n Models
+  void feed_1(std::vector<Lane>&, const Block&, ContIter) const;  // 1 model
+  template <typename Step>
+  void feed_lanes(std::vector<Lane>&, const Block&, Step, bool) const;
+  void init_lane_1(Lane&) const;
+  void init_lane_n(Lane&) const;
   template <typename ContIter>
-  void compress_n_parent(std::unique_ptr<CompressPar>&, ContIter,
+  auto compress_1_sym(ContIter, Lane&, char, bool) const -> prc_t;
+  template <uint8_t IR, typename ContIter>
+  void compress_n_parent(CompressPar&, const MMPar&, ContIter,
                          uint8_t) const;
-  template <typename ContIter>
-  void compress_n_child(std::unique_ptr<CompressPar>&, ContIter, uint8_t) const;
+  template <uint8_t IR, typename ContIter>
+  void compress_n_child(CompressPar&, STMMPar*, ContIter,
+                        uint8_t) const;
 
-  void self_compress_alloc();
-  template <typename ContIter>
-  void self_compress_1(std::unique_ptr<Param>&, ContIter, uint64_t);
-  void self_compress_n(std::unique_ptr<Param>&, uint64_t);
+  // Mixture of models, by a compile-time pipeline or by any models
+  auto conts(const Table64*) const -> const std::unique_ptr<Table64>* {
+    return tbl64.data();
+  }
+  auto conts(const Table32*) const -> const std::unique_ptr<Table32>* {
+    return tbl32.data();
+  }
+  auto conts(const Table16*) const -> const std::unique_ptr<Table16>* {
+    return tbl16.data();
+  }
+  auto conts(const LogTable8*) const -> const std::unique_ptr<LogTable8>* {
+    return lgtbl8.data();
+  }
+  auto conts(const CMLS4*) const -> const std::unique_ptr<CMLS4>* {
+    return cmls4.data();
+  }
+  auto conts(const BlockCMLS4*) const -> const std::unique_ptr<BlockCMLS4>* {
+    return bcmls4.data();
+  }
+  auto conts(const HashTable16*) const
+      -> const std::unique_ptr<HashTable16>* {
+    return hshtbl16.data();
+  }
+  template <typename F>
+  void with_pipeline(const std::vector<MMPar>&, F) const;
+  template <typename... Stages>
+  auto bind(Pipeline<Stages...>&, const std::vector<MMPar>&) const -> bool;
+  template <typename... Stages, size_t... I>
+  auto bind_impl(Pipeline<Stages...>&, const std::vector<MMPar>&,
+                 std::index_sequence<I...>) const -> bool;
+  template <typename S>
+  auto bind_stage(const std::unique_ptr<typename S::cont_t>*&, const MMPar&,
+                  uint8_t, std::array<size_t, CONT_KINDS>&) const -> bool;
+  template <bool Self, typename... Stages>
+  auto mix_symbol(CompressPar&, const Pipeline<Stages...>&,
+                  const std::vector<MMPar>&, uint8_t, char) const -> prc_t;
+  template <bool Self>
+  auto mix_symbol(CompressPar&, const AnyPipeline&,
+                  const std::vector<MMPar>&, uint8_t, char) const -> prc_t;
+  template <uint8_t IR, bool Self, typename... Stages>
+  auto mix_pipeline(CompressPar&, const Pipeline<Stages...>&,
+                    const MMPar*, char) const -> prc_t;
+  template <uint8_t IR, bool Self, size_t I, uint8_t N, typename... Stages>
+  void mix_stages(CompressPar&, const Pipeline<Stages...>&,
+                  const MMPar*, std::false_type) const;
+  template <uint8_t IR, bool Self, size_t I, uint8_t N, typename... Stages>
+  void mix_stages(CompressPar&, const Pipeline<Stages...>&,
+                  const MMPar*, std::true_type) const;  // Past the last stage
+  template <bool Self, typename ContIter>
+  void mix_any(CompressPar&, const MMPar&, ContIter,
+               uint8_t) const;
+  template <uint8_t IR, bool Self, bool TM, typename ContIter>
+  void mix(CompressPar&, const MMPar&, ContIter,
+           uint8_t) const;
+  auto mix_entropy(CompressPar&) const -> prc_t;
+
+  void self_compress_alloc(Pages, uint64_t);
   template <typename ContIter>
-  void self_compress_n_parent(std::unique_ptr<CompressPar>&, ContIter, uint8_t,
-                              uint64_t&) const;
+  auto self_compress_1(std::unique_ptr<Param>&, ContIter) -> prc_t;
+  auto self_compress_n(std::unique_ptr<Param>&) -> prc_t;
+  template <uint8_t IR, typename ContIter>
+  void self_compress_n_parent(CompressPar&, const MMPar&,
+                              ContIter, uint8_t, uint64_t&) const;
 
   template <typename OutT, typename ContIter>
   auto freqs_ir0(ContIter, uint64_t) const -> std::array<OutT, CARDIN>;
@@ -79,8 +234,8 @@ class FCM {  // Finite-context models
   template <typename OutT, typename ContIter, typename ProbParIter>
   auto freqs_ir2(ContIter, ProbParIter) const -> std::array<OutT, CARDIN>;
   auto weight_next(prc_t, prc_t, prc_t) const -> prc_t;
-  template <typename FreqIter>
-  void correct_stmm(std::unique_ptr<CompressPar>&, FreqIter) const;
+  template <uint8_t IR, typename FreqIter>
+  void correct_stmm(CompressPar&, STMMPar*, FreqIter) const;
 #ifdef ARRAY_HISTORY
   template <typename History, typename Value>
   void update_hist_stmm(History&, Value) const;
@@ -15,13 +15,6 @@ namespace smashpp {
 static constexpr float PI{3.14159265f};
 extern void error(std::string&&);
 
-struct SubSeq {
-  std::string inName;
-  std::string outName;
-  uint64_t begPos;
-  std::streamsize size;
-};
-
 inline static void ignore_this_line(std::ifstream& fs) {
   fs.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 }
@@ -77,22 +70,6 @@ inline static uint64_t file_lines(std::string name) {
                                           std::istream_iterator<char>(), '\n'));
 }
 
-// Must be inline
-inline static void extract_subseq(std::unique_ptr<SubSeq>& subseq) {
-  if (subseq->size <= 0) return;
-
-  std::ifstream in_file(subseq->inName);
-  std::ofstream out_file(subseq->outName);
-
-  in_file.seekg(subseq->begPos);
-  std::vector<char> buffer(static_cast<uint64_t>(subseq->size), 0);
-  in_file.read(buffer.data(), subseq->size);
-  out_file.write(buffer.data(), subseq->size);
-
-  in_file.close();
-  out_file.close();
-}
-
 inline static FileType file_type(std::string name) {
   check_file(name);
   std::ifstream f(name);
@@ -2,7 +2,9 @@
 // Morteza Hosseini    seyedmorteza@ua.pt
 // Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
 #include "filter.hpp"
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <numeric>
 #include "file.hpp"
 #include "naming.hpp"
@@ -144,29 +146,93 @@ inline void Filter::show_info(std::unique_ptr<Param>& par) const {
   botrule();
 }
 
-void Filter::smooth_seg(std::vector<PosRow>& pos_out,
-                        std::unique_ptr<Param>& par, uint8_t round,
-                        uint64_t& current_pos_row) {
-  if (par->verbose || round == 1) {
-    par->message = (round == 3) ? "    " : "";
-    par->message += "[+] Filtering " + italic(par->tarName) + " ";
-  }
+// Filter the profile and segment it, as it comes from the compressor, on a
+// thread of its own. The segments are kept in rows, for add_seg
+void Filter::smooth_seg(std::unique_ptr<Param>& par, uint8_t round,
+                        ProfileRing& prf) {
+  std::vector<std::vector<PosRow>> cut_rows;
+  smooth_seg(par, round, prf, {SegCut{par->thresh, par->segSize}}, cut_rows);
+  rows = std::move(cut_rows.front());
+}
 
+// The profile is filtered once, and each filtered value goes to the segments
+// of all cuts, whose rows are in cut_rows, in order of cuts
+void Filter::smooth_seg(std::unique_ptr<Param>& par, uint8_t round,
+                        ProfileRing& prf, const std::vector<SegCut>& cuts,
+                        std::vector<std::vector<PosRow>>& cut_rows) {
+  make_segs(par, round, cuts);
+  cut_rows.assign(cuts.size(), {});
   if (window.size() != 1) {
     if (filt_type == FilterType::rectangular) {
       (par->saveFilter || par->saveAll)
-          ? smooth_seg_rect<true>(pos_out, par, round)
-          : smooth_seg_rect<false>(pos_out, par, round);
+          ? smooth_seg_rect<true>(cut_rows, par, prf)
+          : smooth_seg_rect<false>(cut_rows, par, prf);
     } else {
       // make_window(filt_size);
       (par->saveFilter || par->saveAll)
-          ? smooth_seg_non_rect<true>(pos_out, par, round)
-          : smooth_seg_non_rect<false>(pos_out, par, round);  // todo erroneous
+          ? smooth_seg_non_rect<true>(cut_rows, par, prf)
+          : smooth_seg_non_rect<false>(cut_rows, par, prf);  // todo erroneous
     }
   } else {
-    smooth_seg_win1(pos_out, par, round);
+    smooth_seg_win1(cut_rows, par, prf);
   }
+}
 
+inline void Filter::make_segs(std::unique_ptr<Param>& par, uint8_t round,
+                              const std::vector<SegCut>& cuts) {
+  uint8_t maxCtx = 0;
+  for (const auto& e : par->refMs)
+    if (e.k > maxCtx) maxCtx = e.k;
+
+  segs.assign(cuts.size(), Segment());
+  for (size_t i = 0; i != cuts.size(); ++i) {
+    auto& seg = segs[i];
+    seg.thresh = cuts[i].thresh;
+    seg.minSize = cuts[i].minSize;
+    seg.round = round;
+    seg.sample_step = par->sampleStep;
+    if (round == 2)
+      seg.set_guards(maxCtx, par->ref_guard->beg, par->ref_guard->end);
+    else if (round == 1 || round == 3)
+      seg.set_guards(maxCtx, par->tar_guard->beg, par->tar_guard->end);
+  }
+}
+
+inline void Filter::partition(std::vector<std::vector<PosRow>>& cut_rows,
+                              float filtered) {
+  for (size_t i = 0; i != segs.size(); ++i)
+    segs[i].partition(cut_rows[i], filtered);
+}
+
+inline void Filter::next_pos() {
+  for (auto& seg : segs) ++seg.pos;
+}
+
+inline void Filter::finalize_partition(
+    std::vector<std::vector<PosRow>>& cut_rows) {
+  for (size_t i = 0; i != segs.size(); ++i)
+    segs[i].finalize_partition(cut_rows[i]);
+  nSegs = segs.front().nSegs;
+}
+
+// The ends of the segments are cut at the no. entropies of the profile, known
+// only at its end
+inline void Filter::clip_seg(std::vector<std::vector<PosRow>>& cut_rows,
+                             ProfileRing& prf) {
+  for (auto& rows : cut_rows)
+    for (auto& row : rows)
+      row.end_pos = std::min<uint64_t>(row.end_pos, prf.count());
+}
+
+// Put the segments found by smooth_seg in pos_out, as those of par's run
+void Filter::add_seg(std::vector<PosRow>& pos_out, std::unique_ptr<Param>& par,
+                     uint8_t round, uint64_t current_pos_row) {
+  if (par->verbose || round == 1) {
+    par->message = (round == 3) ? "    " : "";
+    par->message += "[+] Filtering " + italic(par->tarName) + " ";
+  }
+
+  pos_out.insert(std::end(pos_out), std::begin(rows), std::end(rows));
   for (uint64_t i = current_pos_row, j = 0; i != current_pos_row + nSegs;
        ++i, ++j) {
     pos_out.at(i).round = round;
@@ -176,61 +242,29 @@ void Filter::smooth_seg(std::vector<PosRow>& pos_out,
     pos_out.at(i).seg_num = j;
   }
 
-  if (!par->saveAll && !par->saveProfile)
-    remove((gen_name(par->ID, par->refName, par->tarName, Format::profile))
-               .c_str());
-  if (!par->saveAll && !par->saveFilter)
-    remove((gen_name(par->ID, par->refName, par->tarName, Format::filter))
-               .c_str());
-
   if (par->verbose || round == 1) {
     std::cerr << "\r" << par->message << "done => " << nSegs << " segment"
               << (nSegs == 1 ? "" : "s") << '\n';
   }
 }
 
-void Filter::smooth_seg_win1(std::vector<PosRow>& pos_out,
-                             std::unique_ptr<Param>& par, uint8_t round) {
-  const auto profile_name{
-      gen_name(par->ID, par->ref, par->tar, Format::profile)};
-  check_file(profile_name);
-  std::ifstream profile(profile_name);
-  const auto filter_name{gen_name(par->ID, par->ref, par->tar, Format::filter)};
-  std::ofstream filter_file(filter_name);
-
-  const auto jump_lines = [&]() {
-    for (uint64_t i = par->sampleStep; i--;) ignore_this_line(profile);
-  };
-
-  auto seg = std::make_shared<Segment>();
-  seg->thresh = par->thresh;
-  seg->minSize = par->segSize;
-  seg->round = round;
-  seg->sample_step = par->sampleStep;
-
-  uint8_t maxCtx = 0;
-  for (const auto& e : par->refMs)
-    if (e.k > maxCtx) maxCtx = e.k;
-
-  if (round == 2)
-    seg->set_guards(maxCtx, par->ref_guard->beg, par->ref_guard->end);
-  else if (round == 1 || round == 3)
-    seg->set_guards(maxCtx, par->tar_guard->beg, par->tar_guard->end);
+void Filter::smooth_seg_win1(std::vector<std::vector<PosRow>>& cut_rows,
+                             std::unique_ptr<Param>& par, ProfileRing& prf) {
+  const bool save_filter{par->saveFilter || par->saveAll};
+  std::ofstream filter_file;
+  if (save_filter)
+    filter_file.open(gen_name(par->ID, par->ref, par->tar, Format::filter));
 
-  // seg->totalSize = file_lines(profile_name) / par->sampleStep;
-  seg->totalSize = file_lines(profile_name);  // todo
+  // seg.totalSize = file_lines(profile_name) / par->sampleStep;
+  for (auto& seg : segs)
+    seg.totalSize = std::numeric_limits<uint64_t>::max();  // See clip_seg
   auto filtered{0.f};
-  uint64_t symsNo{0};
 
-  for (; profile >> filtered; jump_lines()) {
-    if (par->saveFilter || par->saveAll)
-      filter_file << precision(PREC_FIL, filtered) << '\n';
-    seg->partition(pos_out, filtered);
-    if (par->verbose) show_progress(++symsNo, seg->totalSize, par->message);
+  for (; prf.next(filtered); prf.skip(par->sampleStep - 1)) {
+    if (save_filter) filter_file << precision(PREC_FIL, filtered) << '\n';
+    partition(cut_rows, filtered);
   }
-
-  filter_file.close();
-  profile.close();
+  clip_seg(cut_rows, prf);
 }
 
 inline void Filter::make_window(uint32_t filter_size) {
@@ -597,46 +631,25 @@ inline void Filter::make_nuttall(uint32_t filter_size) {
 // }
 
 template <bool SaveFilter>
-inline void Filter::smooth_seg_rect(std::vector<PosRow>& pos_out,
-                                    std::unique_ptr<Param>& par,
-                                    uint8_t round) {
-  const auto profileName{
-      gen_name(par->ID, par->ref, par->tar, Format::profile)};
-  const auto filterName{gen_name(par->ID, par->ref, par->tar, Format::filter)};
-  check_file(profileName);
-  std::ifstream prfF(profileName);
-  std::ofstream filF(filterName);
-  auto seg = std::make_shared<Segment>();
-  seg->thresh = par->thresh;
-  seg->minSize = par->segSize;
-  seg->round = round;
-  seg->sample_step = par->sampleStep;
-  {
-    uint8_t maxCtx = 0;
-    for (const auto& e : par->refMs)
-      if (e.k > maxCtx) maxCtx = e.k;
-
-    if (round == 2)
-      seg->set_guards(maxCtx, par->ref_guard->beg, par->ref_guard->end);
-    else if (round == 1 || round == 3)
-      seg->set_guards(maxCtx, par->tar_guard->beg, par->tar_guard->end);
-  }
-
-  seg->totalSize = file_lines(profileName);  // todo
-  const auto jump_lines = [&]() {
-    for (uint64_t i = par->sampleStep; i--;) ignore_this_line(prfF);
-  };
+inline void Filter::smooth_seg_rect(
+    std::vector<std::vector<PosRow>>& cut_rows, std::unique_ptr<Param>& par,
+    ProfileRing& prf) {
+  std::ofstream filF;
+  if (SaveFilter)
+    filF.open(gen_name(par->ID, par->ref, par->tar, Format::filter));
+  for (auto& seg : segs)
+    seg.totalSize = std::numeric_limits<uint64_t>::max();  // See clip_seg
+  const auto jump_lines = [&]() { prf.skip(par->sampleStep - 1); };
 
   std::vector<float> seq;
   seq.reserve(filt_size);
   auto entropy{0.f};
-  uint64_t symsNo{0};  // No. syms based on profile
   auto sum{0.f};
 
   // First value
   {
     auto i = (filt_size >> 1u) + 1;
-    for (; i-- && (prfF >> entropy); jump_lines()) {
+    for (; i-- && prf.next(entropy); jump_lines()) {
       seq.push_back(entropy);
       sum += entropy;
     }
@@ -650,71 +663,44 @@ inline void Filter::smooth_seg_rect(std::vector<PosRow>& pos_out,
 
   auto filtered = sum / filt_size;
   if (SaveFilter) filF << precision(PREC_FIL, filtered) << '\n';
-  seg->partition(pos_out, filtered);
-  if (par->verbose) show_progress(++symsNo, seg->totalSize, par->message);
+  partition(cut_rows, filtered);
 
   // The rest
   uint32_t idx{0};
-  for (; prfF >> entropy; jump_lines()) {
+  for (; prf.next(entropy); jump_lines()) {
     sum += entropy - seq[idx];
     filtered = sum / filt_size;
     if (SaveFilter) filF << precision(PREC_FIL, filtered) << '\n';
-    ++seg->pos;
-    seg->partition(pos_out, filtered);
+    next_pos();
+    partition(cut_rows, filtered);
     seq[idx] = entropy;
     idx = (idx + 1) % filt_size;
-    if (par->verbose) show_progress(++symsNo, seg->totalSize, par->message);
   }
-  prfF.close();
 
   // Until half of the window goes outside the array
   for (auto i = 1u; i != half_wsize + 1; ++i) {
     sum -= seq[idx];
     filtered = sum / filt_size;
     if (SaveFilter) filF << precision(PREC_FIL, filtered) << '\n';
-    ++seg->pos;
-    seg->partition(pos_out, filtered);
+    next_pos();
+    partition(cut_rows, filtered);
     idx = (idx + 1) % filt_size;
-    if (par->verbose) show_progress(++symsNo, seg->totalSize, par->message);
   }
-  seg->finalize_partition(pos_out);
-  if (par->verbose) show_progress(++symsNo, seg->totalSize, par->message);
-
-  filF.close();
-  if (!SaveFilter) remove(filterName.c_str());
-  nSegs = seg->nSegs;
+  finalize_partition(cut_rows);
+  clip_seg(cut_rows, prf);
 }
 
 template <bool SaveFilter>
-inline void Filter::smooth_seg_non_rect(std::vector<PosRow>& pos_out,
-                                        std::unique_ptr<Param>& par,
-                                        uint8_t round) {
-  const auto profileName{
-      gen_name(par->ID, par->ref, par->tar, Format::profile)};
-  const auto filterName{gen_name(par->ID, par->ref, par->tar, Format::filter)};
-  check_file(profileName);
-  std::ifstream prfF(profileName);
-  std::ofstream filF(filterName);
-  auto seg = std::make_shared<Segment>();
-  seg->thresh = par->thresh;
-  seg->minSize = par->segSize;
-  seg->round = round;
-  seg->sample_step = par->sampleStep;
-  {
-    uint8_t maxCtx = 0;
-    for (const auto& e : par->refMs)
-      if (e.k > maxCtx) maxCtx = e.k;
-
-    if (round == 2)
-      seg->set_guards(maxCtx, par->ref_guard->beg, par->ref_guard->end);
-    else if (round == 1 || round == 3)
-      seg->set_guards(maxCtx, par->tar_guard->beg, par->tar_guard->end);
-  }
-
-  // seg->totalSize = file_lines(profileName)*par->sampleStep;
-  seg->totalSize = file_size(par->tar);// todo
+inline void Filter::smooth_seg_non_rect(
+    std::vector<std::vector<PosRow>>& cut_rows, std::unique_ptr<Param>& par,
+    ProfileRing& prf) {
+  std::ofstream filF;
+  if (SaveFilter)
+    filF.open(gen_name(par->ID, par->ref, par->tar, Format::filter));
+  // seg.totalSize = file_lines(profileName)*par->sampleStep;
+  for (auto& seg : segs) seg.totalSize = par->views->size(par->tar);// todo
   const auto jump_lines = [&]() {
-    // for (uint64_t i = par->sampleStep; i--;) ignore_this_line(prfF);//todo
+    // prf.skip(par->sampleStep - 1);//todo
   };
   std::vector<float> filtered_values;
   filtered_values.reserve(FILE_WRITE_BUF);
@@ -725,12 +711,11 @@ inline void Filter::smooth_seg_non_rect(std::vector<PosRow>& pos_out,
   std::vector<float> seq;
   seq.reserve(filt_size);
   auto entropy{0.f};
-  uint64_t symsNo{0};  // No. syms based on profile
 
   // First value
   {
     auto i = (filt_size >> 1u) + 1;
-    for (; i-- && (prfF >> entropy); jump_lines()) seq.push_back(entropy);
+    for (; i-- && prf.next(entropy); jump_lines()) seq.push_back(entropy);
     auto num_ent_exist = (filt_size >> 1u) + 1 - i;
     seq.insert(std::begin(seq), num_ent_exist - 1, 2.0);
   }
@@ -746,17 +731,28 @@ inline void Filter::smooth_seg_non_rect(std::vector<PosRow>& pos_out,
   auto filtered = sum / sum_weights;
   // if (SaveFilter) filF << precision(PREC_FIL, filtered) << '\n';
     if (SaveFilter) filtered_values.push_back(filtered);
-  seg->partition(pos_out, filtered);
-  if (par->verbose) show_progress(++symsNo, seg->totalSize, par->message);
+  partition(cut_rows, filtered);
 
-  // The rest
+  // The rest. Windows that are sums of exponentials slide in O(1) per value.
+  // The ring is the first filt_size values of seq, so on a wrap the window
+  // does not slide, and is summed again
   uint32_t idx{0};
   auto seqBeg = std::begin(seq);
-  for (; prfF >> entropy; jump_lines()) {
-    seq[idx] = entropy;
+  WindowSum wsum;
+  const bool sliding{seq.size() >= filt_size &&
+                     wsum.init(filt_type, window.size())};
+  if (sliding) wsum.reset(seq, idx);
+  const auto push = [&](float e) {
+    const auto out{seq[idx]};
+    seq[idx] = e;
     idx = (idx + 1) % filt_size;
-    sum = (std::inner_product(winBeg, winEnd - idx, seqBeg + idx, 0.f) +
-           std::inner_product(winEnd - idx, winEnd, seqBeg, 0.f));
+    if (!sliding)
+      sum = (std::inner_product(winBeg, winEnd - idx, seqBeg + idx, 0.f) +
+             std::inner_product(winEnd - idx, winEnd, seqBeg, 0.f));
+    else if (idx == 0)
+      sum = static_cast<float>(wsum.reset(seq, idx));
+    else
+      sum = static_cast<float>(wsum.slide(out, e));
     filtered = sum / sum_weights;
     // if (SaveFilter) filF << precision(PREC_FIL, filtered) << '\n';
     if (SaveFilter) {
@@ -767,40 +763,77 @@ inline void Filter::smooth_seg_non_rect(std::vector<PosRow>& pos_out,
         filtered_values.reserve(FILE_WRITE_BUF);
       }
     }
-    ++seg->pos;
-    seg->partition(pos_out, filtered);
-    if (par->verbose) show_progress(++symsNo, seg->totalSize, par->message);
-  }
-  prfF.close();
+    next_pos();
+    partition(cut_rows, filtered);
+  };
+  for (; prf.next(entropy); jump_lines()) push(entropy);
 
   // Until half of the window goes outside the array
-  for (auto i = half_wsize; i--;) {
-    seq[idx] = 2.0;
-    // seq[idx] = entropy;
-    idx = (idx + 1) % filt_size;
-    sum = (std::inner_product(winBeg, winEnd - idx, seqBeg + idx, 0.f) +
-           std::inner_product(winEnd - idx, winEnd, seqBeg, 0.f));
-    filtered = sum / sum_weights;
-    // if (SaveFilter) filF << precision(PREC_FIL, filtered) << '\n';
-    if (SaveFilter) {
-      filtered_values.push_back(filtered);
-      if (filtered_values.size() >= FILE_WRITE_BUF) {
-        write_filtered_values();
-        filtered_values.clear();
-        filtered_values.reserve(FILE_WRITE_BUF);
-      }
-    }
-    ++seg->pos;
-    seg->partition(pos_out, filtered);
-    if (par->verbose) show_progress(++symsNo, seg->totalSize, par->message);
-  }
-  seg->finalize_partition(pos_out);
+  for (auto i = half_wsize; i--;) push(2.0);
+  finalize_partition(cut_rows);
   write_filtered_values();//todo
-  if (par->verbose) show_progress(++symsNo, seg->totalSize, par->message);
+}
+
+auto WindowSum::init(FilterType type, uint32_t n) -> bool {
+  terms.clear();
+  size = n;
+  if (n < 2) return false;
+
+  const double phi{2 * std::acos(-1.0) / (n - 1)};  // As in make_window
+  const auto add = [&](std::complex<double> coef, double theta) {
+    Term t;
+    t.coef = coef;
+    t.step = std::polar(1.0, theta);
+    t.back = std::conj(t.step);
+    t.far = std::polar(1.0, theta * n);
+    terms.push_back(t);
+  };
+  switch (type) {
+    case FilterType::hamming:
+      add(0.54, 0), add(-0.46, phi);
+      break;
+    case FilterType::hann:
+      add(0.5, 0), add(-0.5, phi);
+      break;
+    case FilterType::blackman:
+      add(0.42, 0), add(-0.5, phi), add(0.08, 2 * phi);
+      break;
+    case FilterType::nuttall:
+      add(0.36, 0), add(-0.49, phi), add(0.14, 2 * phi), add(-0.01, 3 * phi);
+      break;
+    case FilterType::sine:  // sin(x) = Re(-i e^(ix))
+      add({0, -1}, phi / 2);
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
 
-  filF.close();
-  if (!SaveFilter) remove(filterName.c_str());
-  nSegs = seg->nSegs;
+auto WindowSum::reset(const std::vector<float>& seq, uint32_t oldest)
+    -> double {
+  for (auto& t : terms) {
+    std::complex<double> z{1, 0};
+    t.acc = 0;
+    for (auto j = oldest; j != size; ++j, z *= t.step)
+      t.acc += z * double(seq[j]);
+    for (uint32_t j = 0; j != oldest; ++j, z *= t.step)
+      t.acc += z * double(seq[j]);
+  }
+  return sum();
+}
+
+// sum_{j<n} z^j x_{s+1+j} = (sum_{j<n} z^j x_{s+j} - x_s + z^n x_{s+n}) / z
+auto WindowSum::slide(float out, float in) -> double {
+  for (auto& t : terms)
+    t.acc = t.back * (t.acc - double(out) + t.far * double(in));
+  return sum();
+}
+
+auto WindowSum::sum() const -> double {
+  double s{0};
+  for (const auto& t : terms) s += (t.coef * t.acc).real();
+  return s;
 }
 
 // template <bool SaveFilter>
@@ -1119,27 +1152,50 @@ inline void Filter::smooth_seg_non_rect(std::vector<PosRow>& pos_out,
 //   return static_cast<double>(minEnd-maxBeg) > 0.8 * (maxEnd-minBeg);
 // }
 
-void Filter::extract_seg(std::vector<PosRow>& pos_out, uint8_t round,
-                         uint8_t run_num, std::string ref) const {
+// The segments are views of the target (see SeqViews), written to files only
+// if they are to be saved
+void Filter::extract_seg(std::vector<PosRow>& pos_out,
+                         std::unique_ptr<Param>& par, uint8_t round,
+                         uint8_t run_num) const {
+  const bool spill{par->saveSegment || par->saveAll};
   uint64_t seg_idx{0};
 
   for (const auto& row : pos_out) {
-    if (row.round == round && row.run_num == run_num && row.ref == ref) {
-      auto subseq = std::make_unique<SubSeq>();
-      subseq->inName = row.tar;
-      const auto seg{gen_name(row.run_num, row.ref, row.tar, Format::segment)};
-      subseq->outName = seg + std::to_string(seg_idx);
-      subseq->begPos = row.beg_pos;
-      const uint64_t max_tar_pos{file_size(row.tar) - 1};
-      subseq->size = static_cast<std::streamsize>(
-          row.end_pos > max_tar_pos ? max_tar_pos - subseq->begPos + 1
-                                    : row.end_pos - subseq->begPos + 1);
-      extract_subseq(subseq);
+    if (row.round == round && row.run_num == run_num && row.ref == par->ref) {
+      const auto seg{gen_name(row.run_num, row.ref, row.tar, Format::segment) +
+                     std::to_string(seg_idx)};
+      const uint64_t max_tar_pos{par->views->size(row.tar) - 1};
+      const uint64_t end{std::min<uint64_t>(row.end_pos, max_tar_pos)};
+      par->views->add(seg, row.tar, row.beg_pos, end + 1 - row.beg_pos);
+      if (spill) par->views->spill(seg);
       ++seg_idx;
     }
   }
 }
 
+FilterStream::FilterStream(std::unique_ptr<Param> par_, uint8_t round)
+    : filter(par_), par(std::move(par_)) {
+  thr = std::thread([this, round]() {
+    try {
+      filter.smooth_seg(par, round, ring);
+    } catch (...) {
+      err = std::current_exception();
+      ring.close();  // The compressor would wait for it otherwise
+    }
+  });
+}
+
+FilterStream::~FilterStream() {
+  ring.close();
+  if (thr.joinable()) thr.join();
+}
+
+void FilterStream::join() {
+  ring.close();
+  thr.join();
+  if (err) std::rethrow_exception(err);
+}
+
 #ifdef BENCH
 template <typename Iter, typename Value>
 inline void Filter::shift_left_insert(Iter first, Value v) {
@@ -5,27 +5,72 @@
 #ifndef SMASHPP_FILTER_HPP
 #define SMASHPP_FILTER_HPP
 
+#include <complex>
+#include <exception>
 #include <memory>
+#include <thread>
 #include "par.hpp"
+#include "prfring.hpp"
+#include "segment.hpp"
 
 namespace smashpp {
 static constexpr uint8_t PREC_FIL{3};  // Precisions - floats in filt. file
 
+// Sum of a profile weighted by a window, as the window slides, for windows
+// that are sums of complex exponentials, w(j) = Re sum_k c_k e^(i theta_k j):
+// Hamming, Hann, Blackman, Nuttall and sine. Per value slid in, each term is
+// rotated once, instead of a product per tap, so the cost does not grow with
+// the window size. The filter sums them exactly again, by reset, each time
+// its ring of values wraps, so they do not drift
+class WindowSum {
+ public:
+  auto init(FilterType, uint32_t) -> bool;  // False if not such a window
+  auto reset(const std::vector<float>&, uint32_t)
+      -> double;  // Circular, from oldest => the sum
+  auto slide(float, float) -> double;  // Oldest out, new in => the sum
+
+ private:
+  struct Term {
+    std::complex<double> coef;
+    std::complex<double> step;  // e^(i theta)
+    std::complex<double> back;  // e^(-i theta)
+    std::complex<double> far;   // e^(i theta size)
+    std::complex<double> acc;   // sum_j e^(i theta j) x_j
+  };
+  std::vector<Term> terms;
+  uint32_t size;
+
+  auto sum() const -> double;
+};
+
+// Threshold and min. size, by which a filtered profile is cut in segments
+struct SegCut {
+  float thresh;
+  uint32_t minSize;
+};
+
 class Filter {
  public:
   uint64_t nSegs;
+  std::vector<PosRow> rows;  // Segments found by smooth_seg
 
   Filter();
   explicit Filter(std::unique_ptr<Param>&);
-  void smooth_seg(std::vector<PosRow>&, std::unique_ptr<Param>&, uint8_t,
-                  uint64_t&);
-  void extract_seg(std::vector<PosRow>&, uint8_t, uint8_t, std::string) const;
+  void smooth_seg(std::unique_ptr<Param>&, uint8_t, ProfileRing&);
+  void smooth_seg(std::unique_ptr<Param>&, uint8_t, ProfileRing&,
+                  const std::vector<SegCut>&,
+                  std::vector<std::vector<PosRow>>&);  // Rows of each cut
+  void add_seg(std::vector<PosRow>&, std::unique_ptr<Param>&, uint8_t,
+               uint64_t);  // Put in pos_out
+  void extract_seg(std::vector<PosRow>&, std::unique_ptr<Param>&, uint8_t,
+                   uint8_t) const;
 
  private:
   FilterType filt_type;
   uint32_t filt_size;
   std::string message;
   std::vector<float> window;
+  std::vector<Segment> segs;  // Of the cuts
   struct Position {
     uint64_t beg;
     uint64_t end;
@@ -43,12 +88,19 @@ class Filter {
   void make_welch(uint32_t);
   void make_sine(uint32_t);
   void make_nuttall(uint32_t);
-  void smooth_seg_win1(std::vector<PosRow>&, std::unique_ptr<Param>&, uint8_t);
+  void make_segs(std::unique_ptr<Param>&, uint8_t, const std::vector<SegCut>&);
+  void partition(std::vector<std::vector<PosRow>>&, float);
+  void next_pos();
+  void finalize_partition(std::vector<std::vector<PosRow>>&);
+  void smooth_seg_win1(std::vector<std::vector<PosRow>>&,
+                       std::unique_ptr<Param>&, ProfileRing&);
   template <bool SaveFilter>
-  void smooth_seg_rect(std::vector<PosRow>&, std::unique_ptr<Param>&, uint8_t);
+  void smooth_seg_rect(std::vector<std::vector<PosRow>>&,
+                       std::unique_ptr<Param>&, ProfileRing&);
   template <bool SaveFilter>
-  void smooth_seg_non_rect(std::vector<PosRow>&, std::unique_ptr<Param>&,
-                           uint8_t);
+  void smooth_seg_non_rect(std::vector<std::vector<PosRow>>&,
+                           std::unique_ptr<Param>&, ProfileRing&);
+  void clip_seg(std::vector<std::vector<PosRow>>&, ProfileRing&);
   // bool is_mergable (const Position&, const Position&) const;
 
 #ifdef BENCH
@@ -56,6 +108,25 @@ class Filter {
   void shift_left_insert(Iter, Value);
 #endif
 };
+
+// A profile filtered and segmented while it is made: the compressor pushes its
+// entropies to the ring, from which a thread of its own takes them
+class FilterStream {
+ public:
+  ProfileRing ring;
+  Filter filter;
+
+  FilterStream(std::unique_ptr<Param>, uint8_t);  // Own par, round
+  ~FilterStream();
+  FilterStream(const FilterStream&) = delete;
+  FilterStream& operator=(const FilterStream&) = delete;
+  void join();  // Once the profile is made
+
+ private:
+  std::unique_ptr<Param> par;
+  std::exception_ptr err;  // Thrown by the thread
+  std::thread thr;
+};
 }  // namespace smashpp
 
 #endif  // SMASHPP_FILTER_HPP
\ No newline at end of file
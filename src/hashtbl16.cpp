@@ -0,0 +1,133 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "hashtbl16.hpp"
+
+#include <fstream>
+
+#include "exception.hpp"
+#include "file.hpp"
+using namespace smashpp;
+
+HashTable16::HashTable16(uint8_t k_, Pages pages_, uint64_t touched)
+    : tbl(std::make_unique<Storage<HashSlot>>()),
+      k(k_),
+      bits(0),
+      nRows(0),
+      pages(pages_) {
+  alloc(bits_for(touched));
+}
+
+// The no. slots is the size of the file, a power of 2
+HashTable16::HashTable16(uint8_t k_, const std::string& name, uint64_t offset)
+    : tbl(std::make_unique<Storage<HashSlot>>()),
+      k(k_),
+      bits(0),
+      nRows(0),
+      pages(Pages::transparent) {
+  const auto n{(file_size(name) - offset) / sizeof(HashSlot)};
+  while ((1ull << bits) < n) ++bits;
+  if (n != (1ull << bits) || !tbl->map(name, offset, n))
+    error("failed loading model \"" + name + "\".");
+}
+
+auto HashTable16::bits_for(uint64_t rows) -> uint8_t {
+  uint8_t b{HT_MIN_BITS};
+  while (3 * (1ull << b) < 4 * rows) ++b;
+  return b;
+}
+
+inline void HashTable16::alloc(uint8_t nBits) {
+  bits = nBits;
+  nRows = 0;
+  try {
+    tbl->resize(1ull << bits, pages);
+  } catch (std::bad_alloc& b) {
+    error("failed memory allocation.");
+  }
+}
+
+// Fibonacci hashing, as Storage
+inline uint64_t HashTable16::home(uint64_t row) const {
+  return (row * 0x9E3779B97F4A7C15ull) >> (64u - bits);
+}
+
+inline uint64_t HashTable16::slot(uint64_t row) const {
+  const auto mask{(1ull << bits) - 1};
+  const Storage<HashSlot>& t{*tbl};  // Read, so not flagged written to
+  auto i{home(row)};
+  while (t[i].ctrs != 0 && t[i].row != row) i = (i + 1) & mask;
+  return i;
+}
+
+void HashTable16::update(HashTable16::ctx_t ctx) {
+  const auto row{ctx >> 2u};
+  const auto shift{(ctx & 3u) << 4u};
+  auto s{slot(row)};
+  if ((*tbl)[s].ctrs == 0) {
+    if (4 * (nRows + 1) > 3 * (1ull << bits)) {  // Load factor <= 3/4
+      grow();
+      s = slot(row);
+    }
+    (*tbl)[s].row = row;
+    ++nRows;
+  }
+  auto& ctrs = (*tbl)[s].ctrs;
+  if (((ctrs >> shift) & 0xFFFFu) == 0xFFFFu)  // Halve all 4
+    ctrs = (ctrs >> 1u) & 0x7FFF7FFF7FFF7FFFull;
+  ctrs += 1ull << shift;
+}
+
+void HashTable16::grow() {
+  auto old{std::move(tbl)};
+  tbl = std::make_unique<Storage<HashSlot>>();
+  const auto n{nRows};
+  alloc(bits + 1);
+  for (const auto& e : *old)
+    if (e.ctrs != 0) (*tbl)[slot(e.row)] = e;
+  nRows = n;
+}
+
+auto HashTable16::query(HashTable16::ctx_t ctx) const -> HashTable16::val_t {
+  const Storage<HashSlot>& t{*tbl};
+  return static_cast<val_t>(t[slot(ctx >> 2u)].ctrs >>
+                            ((ctx & 3u) << 4u));
+}
+
+auto HashTable16::query_counters(HashTable16::ctx_t l) const
+    -> std::array<HashTable16::val_t, CARDIN> {
+  const Storage<HashSlot>& t{*tbl};
+  const auto ctrs{t[slot(l >> 2u)].ctrs};
+  return {static_cast<val_t>(ctrs), static_cast<val_t>(ctrs >> 16u),
+          static_cast<val_t>(ctrs >> 32u), static_cast<val_t>(ctrs >> 48u)};
+}
+
+void HashTable16::prefetch(HashTable16::ctx_t ctx) const {
+  tbl->prefetch(home(ctx >> 2u));
+}
+
+auto HashTable16::page_size() const -> uint64_t { return tbl->page_size(); }
+
+auto HashTable16::is_sparse() const -> bool { return false; }
+
+auto HashTable16::held() const -> uint64_t { return tbl->bytes(); }
+
+void HashTable16::clear() {
+  tbl->clear();
+  nRows = 0;
+}
+
+void HashTable16::fit(Pages pages_, uint64_t touched) {
+  pages = pages_;
+  if (bits_for(touched) != bits) alloc(bits_for(touched));
+}
+
+auto HashTable16::bytes(uint64_t touched) -> uint64_t {
+  return (1ull << bits_for(touched)) * sizeof(HashSlot);
+}
+
+void HashTable16::dump(std::ofstream& ofs) const {
+  ofs.write(reinterpret_cast<const char*>(tbl->data()),
+            static_cast<std::streamsize>(tbl->size() * sizeof(HashSlot)));
+}
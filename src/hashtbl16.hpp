@@ -0,0 +1,64 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_HASHTABLE16_HPP
+#define SMASHPP_HASHTABLE16_HPP
+
+#include <memory>
+
+#include "def.hpp"
+#include "storage.hpp"
+
+namespace smashpp {
+static constexpr uint8_t HT_MIN_BITS{10};  // log2 no. slots, at least
+
+struct HashSlot {  // A row -- context, no symbol -- and its counters
+  uint64_t row;
+  uint64_t ctrs;  // Of symbol s at bits [16s, 16s+16). 0 if the slot is empty
+};
+
+// Exact counts of the contexts seen, for large k: the rows in an open
+// addressing hash table, Fibonacci hashed and linearly probed. The 4 counters
+// of a row are packed in a word, so a query reads a few adjacent slots, where
+// a sketch reads d cells all over it; all 4 are halved when one would
+// overflow. A slot is 16 bytes, whatever k, and
+// the table doubles when 3/4 full. It grows as it is fed, so it is fed by one
+// thread at a time.
+class HashTable16 {
+  using ctx_t = uint64_t;
+  using val_t = uint16_t;
+
+ private:
+  std::unique_ptr<Storage<HashSlot>> tbl;  // Slots
+  uint8_t k;                               // Ctx size
+  uint8_t bits;                            // log2 no. slots
+  uint64_t nRows;                          // Slots in use
+  Pages pages;                             // Of the table, as it grows
+
+ public:
+  HashTable16() : k(0), bits(0), nRows(0), pages(Pages::transparent) {}
+  explicit HashTable16(uint8_t, Pages = Pages::transparent, uint64_t = 0);
+  HashTable16(uint8_t, const std::string&, uint64_t);  // Map from model file
+  void update(ctx_t);                // Update table
+  auto query(ctx_t) const -> val_t;  // Query count of ctx
+  auto query_counters(ctx_t) const -> std::array<val_t, CARDIN>;
+  void prefetch(ctx_t) const;  // Hint that the slot of a row is read soon
+  auto page_size() const -> uint64_t;  // Pages of the table (bytes)
+  auto is_sparse() const -> bool;      // Never; it is a sparse table itself
+  void clear();                        // Zero the counters, for reuse
+  auto held() const -> uint64_t;       // Bytes taken, as it is
+  void fit(Pages, uint64_t);  // Slots as if new, for n touched
+  static auto bytes(uint64_t) -> uint64_t;  // If new, touched
+  void dump(std::ofstream&) const;  // Write slots into model file
+
+ private:
+  static auto bits_for(uint64_t) -> uint8_t;  // Slots for n rows, log2
+  void alloc(uint8_t);                         // 2^bits empty slots
+  auto home(uint64_t) const -> uint64_t;       // First slot probed for a row
+  auto slot(uint64_t) const -> uint64_t;  // Of a row, or the empty one
+  void grow();                            // Double the slots
+};
+}  // namespace smashpp
+
+#endif  // SMASHPP_HASHTABLE16_HPP
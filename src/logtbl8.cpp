@@ -11,14 +11,21 @@
 #include "exception.hpp"
 using namespace smashpp;
 
-LogTable8::LogTable8(uint8_t k_) : k(k_), tot(0) {
+LogTable8::LogTable8(uint8_t k_, Pages pages, uint64_t touched)
+    : k(k_), tot(0) {
   try {  // 4<<2k = 4*2^2k = 4*4^k = 4^(k+1)
-    tbl.resize(4ull << (k << 1u));
+    tbl.resize(4ull << (k << 1u), pages, touched);
   } catch (std::bad_alloc& b) {
     error("failed memory allocation.");
   }
 }
 
+LogTable8::LogTable8(uint8_t k_, const std::string& name, uint64_t offset)
+    : k(k_), tot(0) {
+  if (!tbl.map(name, offset, 4ull << (k << 1u)))
+    error("failed loading model \"" + name + "\".");
+}
+
 void LogTable8::update(LogTable8::ctx_t ctx) {
   if ((tot++ & POW2minus1[tbl[ctx]]) == 0)  // x % 2^n = x & (2^n-1)
     ++tbl[ctx];
@@ -27,6 +34,12 @@ void LogTable8::update(LogTable8::ctx_t ctx) {
   //    ++(*addr);
 }
 
+// Increments are decided by the rank "n" of the element instead of "tot", so
+// threads that own distinct row ranges fill the table exactly as update(ctx_t)
+void LogTable8::update(LogTable8::ctx_t ctx, uint64_t n) {
+  if ((n & POW2minus1[tbl[ctx]]) == 0) ++tbl[ctx];
+}
+
 auto LogTable8::query(LogTable8::ctx_t ctx) const -> LogTable8::val_t {
   return POW2minus1[tbl[ctx]];  // POW2[tbl[ctx]] - 1
 }
@@ -40,16 +53,39 @@ auto LogTable8::query_counters(LogTable8::ctx_t l) const
           static_cast<LogTable8::val_t>((1ul << *(row_address + 3ul)) - 1ul)};
 }
 
-#ifdef DEBUG
-void LogTable8::dump(std::ofstream& ofs) const {
-  ofs.write((const char*)&tbl[0], tbl.size());
-  //  ofs.close();
+void LogTable8::prefetch(LogTable8::ctx_t ctx) const { tbl.prefetch(ctx); }
+
+auto LogTable8::page_size() const -> uint64_t { return tbl.page_size(); }
+
+auto LogTable8::is_sparse() const -> bool { return tbl.is_sparse(); }
+
+auto LogTable8::held() const -> uint64_t { return tbl.bytes(); }
+
+void LogTable8::clear() {
+  tbl.clear();
+  tot = 0;
 }
 
-void LogTable8::load(std::ifstream& ifs) const {
-  ifs.read((char*)&tbl[0], tbl.size());
+void LogTable8::fit(Pages pages, uint64_t touched) {
+  if (tbl.fits(touched)) return;
+  try {
+    tbl.resize(tbl.size(), pages, touched);
+  } catch (std::bad_alloc& b) {
+    error("failed memory allocation.");
+  }
+}
+
+auto LogTable8::bytes(uint8_t k, uint64_t touched) -> uint64_t {
+  return Storage<uint8_t>::bytes_for(4ull << (k << 1u), touched);
 }
 
+void LogTable8::dump(std::ofstream& ofs) const {
+  ofs.write(reinterpret_cast<const char*>(tbl.data()),
+            static_cast<std::streamsize>(tbl.size()));
+}
+
+#ifdef DEBUG
+
 uint64_t LogTable8::get_total() const { return tot; }
 
 uint64_t LogTable8::count_empty() const {
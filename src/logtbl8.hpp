@@ -5,9 +5,8 @@
 #ifndef SMASHPP_LOGTABLE8_HPP
 #define SMASHPP_LOGTABLE8_HPP
 
-#include <vector>
-
 #include "def.hpp"
+#include "storage.hpp"
 
 namespace smashpp {
 class LogTable8 {
@@ -15,20 +14,28 @@ class LogTable8 {
   using val_t = uint32_t;
 
  private:
-  std::vector<uint8_t> tbl;  // Table of 8 bit logarithmic counters
-  uint8_t k;                 // Ctx size
-  uint64_t tot;              // Total # elements so far
+  Storage<uint8_t> tbl;  // Table of 8 bit logarithmic counters
+  uint8_t k;             // Ctx size
+  uint64_t tot;          // Total # elements so far
 
  public:
   LogTable8() : k(0), tot(0) {}
-  explicit LogTable8(uint8_t);
+  explicit LogTable8(uint8_t, Pages = Pages::transparent, uint64_t = 0);
+  LogTable8(uint8_t, const std::string&, uint64_t);  // Map from model file
   void update(ctx_t);                // Update table
+  void update(ctx_t, uint64_t);      // Update as the n-th element
   auto query(ctx_t) const -> val_t;  // Query count of ctx
   auto query_counters(ctx_t) const -> std::array<val_t, CARDIN>;
+  void prefetch(ctx_t) const;  // Hint that a row is read soon
+  auto page_size() const -> uint64_t;  // Pages of the table (bytes)
+  auto is_sparse() const -> bool;      // See Storage
+  void clear();                        // Zero the counters, for reuse
+  auto held() const -> uint64_t;       // Bytes taken, as it is
+  void fit(Pages, uint64_t);  // Sparse or not as if new, for n touched
+  static auto bytes(uint8_t, uint64_t) -> uint64_t;  // If new, k, touched
+  void dump(std::ofstream&) const;   // Write counters into model file
 
 #ifdef DEBUG
-  void dump(std::ofstream&) const;
-  void load(std::ifstream&) const;
   auto get_total() const -> uint64_t;  // Total count of all items in the table
   auto count_empty() const -> uint64_t;  // Number of empty cells in the table
   auto max_tbl_val() const -> uint32_t;
@@ -0,0 +1,142 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "mdlcache.hpp"
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "bcmls4.hpp"
+#include "file.hpp"
+using namespace smashpp;
+
+static bool is_sketch(const MMPar& m) {
+  return m.cont == Container::sketch_8 || m.cont == Container::block_sketch_8;
+}
+
+ModelHeader::ModelHeader(const MMPar& m, uint64_t hash, uint64_t size)
+    : version(MDL_VERSION),
+      cont(static_cast<uint8_t>(m.cont)),
+      k(m.k),
+      d(is_sketch(m) ? m.d : 0),
+      reserved(0),
+      w(is_sketch(m) ? m.w : 0),
+      refHash(hash),
+      refSize(size),
+      nBytes(model_bytes(m)) {
+  std::memset(magic, 0, sizeof(magic));
+  std::memcpy(magic, MDL_MAGIC.data(), MDL_MAGIC.size());
+}
+
+bool ModelHeader::matches(const ModelHeader& h) const {
+  return std::memcmp(magic, h.magic, sizeof(magic)) == 0 &&
+         version == h.version && cont == h.cont && k == h.k && d == h.d &&
+         w == h.w && refHash == h.refHash && refSize == h.refSize &&
+         nBytes == h.nBytes;
+}
+
+ModelCache::ModelCache(std::string dir_, std::string ref)
+    : dir(std::move(dir_)), refHash(hash_file(ref)), refSize(file_size(ref)) {
+  if (!dir.empty() && dir.back() != '/' && dir.back() != '\\') dir += '/';
+}
+
+std::string ModelCache::name(const MMPar& m) const {
+  std::ostringstream oss;
+  oss << dir << std::hex << std::setw(16) << std::setfill('0') << refHash
+      << std::dec << "-k" << static_cast<int>(m.k);
+  switch (m.cont) {
+    case Container::table_64:
+      oss << "-tbl64";
+      break;
+    case Container::table_32:
+      oss << "-tbl32";
+      break;
+    case Container::table_16:
+      oss << "-tbl16";
+      break;
+    case Container::log_table_8:
+      oss << "-lgtbl8";
+      break;
+    case Container::sketch_8:
+      oss << "-cmls4-w" << m.w << "-d" << static_cast<int>(m.d);
+      break;
+    case Container::block_sketch_8:
+      oss << "-bcmls4-w" << m.w << "-d" << static_cast<int>(m.d);
+      break;
+    case Container::hash_table_16:
+      oss << "-hshtbl16";
+      break;
+  }
+  oss << ".mdl";
+  return oss.str();
+}
+
+bool ModelCache::has(const MMPar& m) const {
+  const auto mdl_name{name(m)};
+  std::ifstream mdl_file(mdl_name, std::ios::binary | std::ios::ate);
+  if (!mdl_file) return false;
+  const auto size = static_cast<uint64_t>(mdl_file.tellg());
+
+  ModelHeader header;
+  mdl_file.seekg(0);
+  mdl_file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!mdl_file) return false;
+
+  return header.matches(ModelHeader(m, refHash, refSize)) &&
+         size >= MDL_HDR_SIZE + header.nBytes;
+}
+
+uint64_t smashpp::model_bytes(const MMPar& m) {
+  const auto n_ctx{4ull << (m.k << 1u)};  // 4^(k+1)
+  switch (m.cont) {
+    case Container::table_64:
+      return n_ctx * sizeof(uint64_t);
+    case Container::table_32:
+      return n_ctx * sizeof(uint32_t);
+    case Container::table_16:
+      return (n_ctx >> 2u) * sizeof(uint64_t);  // A word per row
+    case Container::log_table_8:
+      return n_ctx;
+    case Container::sketch_8:
+      return (m.d * m.w + 1) >> 1u;
+    case Container::block_sketch_8:
+      return BlockCMLS4::lines(m.w, m.d) * BLK_LINE;
+    case Container::hash_table_16:
+      return 0;  // As many slots as the reference needs (see HashTable16)
+  }
+  return 0;
+}
+
+// 64 bit content fingerprint (not cryptographic), eight bytes at a time
+uint64_t smashpp::hash_file(const std::string& name) {
+  constexpr uint64_t P1{0x9E3779B185EBCA87ull};
+  constexpr uint64_t P2{0xC2B2AE3D27D4EB4Full};
+  constexpr size_t buf_size{1024 * 1024};
+  const auto mix = [](uint64_t h, uint64_t v) {
+    h ^= v * P2;
+    h = (h << 31u) | (h >> 33u);
+    return h * P1;
+  };
+
+  std::ifstream in_file(name, std::ios::binary);
+  uint64_t h{P1};
+  uint64_t len{0};
+  std::vector<char> buffer(buf_size);
+  while (in_file) {
+    in_file.read(buffer.data(), buf_size);
+    const auto n = static_cast<uint64_t>(in_file.gcount());
+    uint64_t i{0};
+    for (uint64_t v; i + 8 <= n; i += 8) {
+      std::memcpy(&v, buffer.data() + i, 8);
+      h = mix(h, v);
+    }
+    for (; i != n; ++i) h = mix(h, static_cast<uint8_t>(buffer[i]));
+    len += n;
+  }
+
+  h = mix(h, len);
+  h ^= h >> 29u;
+  return h * P2;
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_MDLCACHE_HPP
+#define SMASHPP_MDLCACHE_HPP
+
+#include <fstream>
+#include <random>
+
+#include "mdlpar.hpp"
+
+namespace smashpp {
+static const std::string MDL_MAGIC{"SMPPMDL"};  // Magic of model files
+static constexpr uint32_t MDL_VERSION{1};
+static constexpr uint64_t MDL_HDR_SIZE{4096};  // Page aligned counters
+
+// Fixed-size header of a model file, followed by the serialized counters
+struct ModelHeader {
+  char magic[8];
+  uint32_t version;
+  uint8_t cont;      // Container
+  uint8_t k;         // Context size
+  uint8_t d;         // Depth of sketch
+  uint8_t reserved;
+  uint64_t w;        // Width of sketch
+  uint64_t refHash;  // Content hash of the reference
+  uint64_t refSize;  // Size of the reference (bytes)
+  uint64_t nBytes;   // Size of the serialized counters (bytes)
+
+  ModelHeader() = default;
+  ModelHeader(const MMPar&, uint64_t, uint64_t);
+  auto matches(const ModelHeader&) const -> bool;
+};
+
+// On-disk cache of reference models. A model is keyed by the content hash of
+// the reference, its container and the parameters that shape the counters
+// (k, w, d). Alpha, gamma and IR only matter at query time, so they do not
+// take part in the key.
+class ModelCache {
+ public:
+  ModelCache(std::string, std::string);
+  auto name(const MMPar&) const -> std::string;  // Model file name
+  auto has(const MMPar&) const -> bool;          // Valid model file exists
+  template <typename Cont>
+  void save(const MMPar&, const Cont&) const;
+
+ private:
+  std::string dir;
+  uint64_t refHash;
+  uint64_t refSize;
+};
+
+template <typename Cont>
+void ModelCache::save(const MMPar& m, const Cont& cont) const {
+  const auto mdl_name{name(m)};
+  const auto tmp_name{mdl_name + ".tmp" +
+                      std::to_string(std::random_device{}())};
+  std::ofstream mdl_file(tmp_name, std::ios::binary);
+  if (!mdl_file) return;  // Read-only cache directory: nothing to do
+
+  const ModelHeader header(m, refHash, refSize);
+  mdl_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  const std::vector<char> pad(MDL_HDR_SIZE - sizeof(header), 0);
+  mdl_file.write(pad.data(), static_cast<std::streamsize>(pad.size()));
+  cont.dump(mdl_file);
+  mdl_file.close();
+
+  if (!mdl_file || std::rename(tmp_name.c_str(), mdl_name.c_str()) != 0)
+    std::remove(tmp_name.c_str());
+}
+
+auto model_bytes(const MMPar&) -> uint64_t;  // Memory of a model (bytes)
+auto hash_file(const std::string&) -> uint64_t;
+}  // namespace smashpp
+
+#endif  // SMASHPP_MDLCACHE_HPP
\ No newline at end of file
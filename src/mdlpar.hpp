@@ -5,10 +5,15 @@
 #ifndef SMASHPP_MDLPAR_HPP
 #define SMASHPP_MDLPAR_HPP
 
+#include <algorithm>
+#include <array>
 #include <memory>
+#include <vector>
 #include "def.hpp"
 
 namespace smashpp {
+static constexpr uint8_t MAX_MDL{16};  // Models mixed, tolerant included
+
 struct STMMPar;
 
 struct MMPar {
@@ -119,23 +124,43 @@ inline void ProbPar::config_ir2(char c, uint64_t ctx, uint64_t ctxIr) {
   r = ctxIr >> 2u;
 }
 
+// State of the mixture of models, one entry per model (tolerant models
+// included), in fixed-size arrays so that no symbol has to allocate
 struct CompressPar {
-  std::vector<uint64_t> ctx;
-  std::vector<uint64_t> ctxIr;
-  std::vector<prc_t> w;
-  std::vector<prc_t> wNext;
-  std::vector<prc_t> probs;
-  std::vector<ProbPar> pp;
-  std::vector<ProbPar>::iterator ppIt;
-  std::vector<uint64_t>::iterator ctxIt;
-  std::vector<uint64_t>::iterator ctxIrIt;
+  std::array<uint64_t, MAX_MDL> ctx;
+  std::array<uint64_t, MAX_MDL> ctxIr;
+  std::array<prc_t, MAX_MDL> w;
+  std::array<prc_t, MAX_MDL> wNext;
+  std::array<prc_t, MAX_MDL> probs;
+  std::array<ProbPar, MAX_MDL> pp;
+  ProbPar* ppIt;
+  uint64_t* ctxIt;
+  uint64_t* ctxIrIt;
   uint8_t nMdl;
   uint8_t nSym;
   char c;
-  MMPar mm;
 
   CompressPar() = default;
+  void init(const std::vector<MMPar>&);
 };
+
+inline void CompressPar::init(const std::vector<MMPar>& Ms) {
+  nMdl = 0;
+  for (const auto& mm : Ms) {  // Mask: 1<<2k - 1 = 4^k - 1
+    const auto mask{(1ull << (mm.k << 1u)) - 1};
+    ctx[nMdl] = 0;
+    ctxIr[nMdl] = mask;
+    pp[nMdl++] = ProbPar(mm.alpha, mask, static_cast<uint8_t>(mm.k << 1u));
+    if (mm.child) {
+      ctx[nMdl] = 0;
+      ctxIr[nMdl] = mask;
+      pp[nMdl++] =
+          ProbPar(mm.child->alpha, mask, static_cast<uint8_t>(mm.k << 1u));
+    }
+  }
+  std::fill_n(std::begin(w), nMdl, static_cast<prc_t>(1) / nMdl);
+  std::fill_n(std::begin(wNext), nMdl, static_cast<prc_t>(0));
+}
 }  // namespace smashpp
 
 #endif  // SMASHPP_MDLPAR_HPP
\ No newline at end of file
@@ -0,0 +1,74 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "mdlpool.hpp"
+using namespace smashpp;
+
+// Models over the new cap are dropped, oldest first
+void ModelPool::set_cap(uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(mut);
+  cap = bytes;
+  while (held > cap && evict()) {
+  }
+}
+
+// Of each kind, the entries are in the order given back
+bool ModelPool::evict() {
+  const std::array<uint64_t, CONT_KINDS> oldest{
+      {age(tbl64), age(tbl32), age(tbl16), age(lgtbl8), age(cmls4),
+       age(bcmls4), age(hshtbl16)}};
+  const auto it{std::min_element(std::begin(oldest), std::end(oldest))};
+  if (*it == UINT64_MAX) return false;
+  switch (it - std::begin(oldest)) {
+    case 0: pop(tbl64); break;
+    case 1: pop(tbl32); break;
+    case 2: pop(tbl16); break;
+    case 3: pop(lgtbl8); break;
+    case 4: pop(cmls4); break;
+    case 5: pop(bcmls4); break;
+    default: pop(hshtbl16);
+  }
+  return true;
+}
+
+uint64_t ModelPool::shape(const MMPar& m) const {
+  const bool sketch{m.cont == Container::sketch_8 ||
+                    m.cont == Container::block_sketch_8};
+  return sketch ? (m.w << 8u) | m.d : m.k;
+}
+
+auto ModelPool::make(const Table64*, const MMPar& m, Pages pages,
+                     uint64_t touched) const -> std::unique_ptr<Table64> {
+  return std::make_unique<Table64>(m.k, pages, touched);
+}
+
+auto ModelPool::make(const Table32*, const MMPar& m, Pages pages,
+                     uint64_t touched) const -> std::unique_ptr<Table32> {
+  return std::make_unique<Table32>(m.k, pages, touched);
+}
+
+auto ModelPool::make(const Table16*, const MMPar& m, Pages pages,
+                     uint64_t touched) const -> std::unique_ptr<Table16> {
+  return std::make_unique<Table16>(m.k, pages, touched);
+}
+
+auto ModelPool::make(const LogTable8*, const MMPar& m, Pages pages,
+                     uint64_t touched) const -> std::unique_ptr<LogTable8> {
+  return std::make_unique<LogTable8>(m.k, pages, touched);
+}
+
+auto ModelPool::make(const CMLS4*, const MMPar& m, Pages pages,
+                     uint64_t touched) const -> std::unique_ptr<CMLS4> {
+  return std::make_unique<CMLS4>(m.w, m.d, pages, touched);
+}
+
+auto ModelPool::make(const BlockCMLS4*, const MMPar& m, Pages pages,
+                     uint64_t touched) const -> std::unique_ptr<BlockCMLS4> {
+  return std::make_unique<BlockCMLS4>(m.w, m.d, pages, touched);
+}
+
+auto ModelPool::make(const HashTable16*, const MMPar& m, Pages pages,
+                     uint64_t touched) const -> std::unique_ptr<HashTable16> {
+  return std::make_unique<HashTable16>(m.k, pages, touched);
+}
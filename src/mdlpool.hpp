@@ -0,0 +1,150 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_MDLPOOL_HPP
+#define SMASHPP_MDLPOOL_HPP
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "bcmls4.hpp"
+#include "cmls4.hpp"
+#include "hashtbl16.hpp"
+#include "logtbl8.hpp"
+#include "mdlpar.hpp"
+#include "par.hpp"
+#include "tbl16.hpp"
+#include "tbl32.hpp"
+#include "tbl64.hpp"
+
+namespace smashpp {
+// Models given back by FCMs, for the next ones to reuse. Rounds 2 and 3 and
+// the ref-free compression of the segments build models of the same shapes,
+// one segment after another. A model is zeroed when given back, keeping its
+// memory resident (see Storage::clear), so taking it costs no allocation nor
+// page faults. Models are matched by the parameters that shape their
+// counters: k, or w and d for sketches. The pool holds "cap" bytes at most,
+// dropping the models given back the longest ago to make room. Can be used by
+// many threads at once.
+class ModelPool {
+ public:
+  void set_cap(uint64_t);  // Bytes
+  template <typename Cont>
+  auto get(const MMPar&, Pages, uint64_t) -> std::unique_ptr<Cont>;
+  template <typename Cont>
+  void put(const MMPar&, std::unique_ptr<Cont>);
+
+ private:
+  template <typename Cont>
+  struct Entry {
+    uint64_t shape;
+    uint64_t bytes;  // Held
+    uint64_t age;    // When given back
+    std::unique_ptr<Cont> cont;
+  };
+  std::mutex mut;
+  uint64_t cap{POOL_BYTES};
+  uint64_t held{0};  // Bytes, by all entries
+  uint64_t ages{0};  // No. models given back
+  std::vector<Entry<Table64>> tbl64;
+  std::vector<Entry<Table32>> tbl32;
+  std::vector<Entry<Table16>> tbl16;
+  std::vector<Entry<LogTable8>> lgtbl8;
+  std::vector<Entry<CMLS4>> cmls4;
+  std::vector<Entry<BlockCMLS4>> bcmls4;
+  std::vector<Entry<HashTable16>> hshtbl16;
+
+  auto entries(const Table64*) -> std::vector<Entry<Table64>>& {
+    return tbl64;
+  }
+  auto entries(const Table32*) -> std::vector<Entry<Table32>>& {
+    return tbl32;
+  }
+  auto entries(const Table16*) -> std::vector<Entry<Table16>>& {
+    return tbl16;
+  }
+  auto entries(const LogTable8*) -> std::vector<Entry<LogTable8>>& {
+    return lgtbl8;
+  }
+  auto entries(const CMLS4*) -> std::vector<Entry<CMLS4>>& { return cmls4; }
+  auto entries(const BlockCMLS4*) -> std::vector<Entry<BlockCMLS4>>& {
+    return bcmls4;
+  }
+  auto entries(const HashTable16*) -> std::vector<Entry<HashTable16>>& {
+    return hshtbl16;
+  }
+  auto shape(const MMPar&) const -> uint64_t;
+  auto evict() -> bool;  // The oldest entry, if any, with "mut" held
+  template <typename Cont>
+  static auto age(const std::vector<Entry<Cont>>& pool) -> uint64_t {
+    return pool.empty() ? UINT64_MAX : pool.front().age;
+  }
+  template <typename Cont>
+  void pop(std::vector<Entry<Cont>>& pool) {
+    held -= pool.front().bytes;
+    pool.erase(std::begin(pool));
+  }
+  auto make(const Table64*, const MMPar&, Pages, uint64_t) const
+      -> std::unique_ptr<Table64>;
+  auto make(const Table32*, const MMPar&, Pages, uint64_t) const
+      -> std::unique_ptr<Table32>;
+  auto make(const Table16*, const MMPar&, Pages, uint64_t) const
+      -> std::unique_ptr<Table16>;
+  auto make(const LogTable8*, const MMPar&, Pages, uint64_t) const
+      -> std::unique_ptr<LogTable8>;
+  auto make(const CMLS4*, const MMPar&, Pages, uint64_t) const
+      -> std::unique_ptr<CMLS4>;
+  auto make(const BlockCMLS4*, const MMPar&, Pages, uint64_t) const
+      -> std::unique_ptr<BlockCMLS4>;
+  auto make(const HashTable16*, const MMPar&, Pages, uint64_t) const
+      -> std::unique_ptr<HashTable16>;
+};
+
+// A model of the shape of "m", from the pool if there is one, else new. The
+// last argument is the no. counters it may touch (see Storage::resize)
+template <typename Cont>
+auto ModelPool::get(const MMPar& m, Pages pages, uint64_t touched)
+    -> std::unique_ptr<Cont> {
+  std::unique_ptr<Cont> cont;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    auto& pool = entries(static_cast<const Cont*>(nullptr));
+    const auto it =
+        std::find_if(std::begin(pool), std::end(pool),
+                     [&](const Entry<Cont>& e) { return e.shape == shape(m); });
+    if (it != std::end(pool)) {
+      held -= it->bytes;
+      cont = std::move(it->cont);
+      pool.erase(it);
+    }
+  }
+  if (!cont) return make(static_cast<const Cont*>(nullptr), m, pages, touched);
+  cont->fit(pages, touched);
+  return cont;
+}
+
+// Freed instead, if it does not fit in the cap. Zeroed out of the lock, its
+// room reserved first
+template <typename Cont>
+void ModelPool::put(const MMPar& m, std::unique_ptr<Cont> cont) {
+  if (!cont) return;
+  const auto bytes{cont->held()};
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    while (held + bytes > cap && evict()) {
+    }
+    if (held + bytes > cap) return;  // Others being given back, if not alone
+    held += bytes;
+  }
+  cont->clear();
+  std::lock_guard<std::mutex> lock(mut);
+  entries(static_cast<const Cont*>(nullptr))
+      .push_back(Entry<Cont>{shape(m), bytes, ages++, std::move(cont)});
+}
+}  // namespace smashpp
+
+#endif  // SMASHPP_MDLPOOL_HPP
@@ -0,0 +1,159 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "memplan.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+
+#include "exception.hpp"
+#include "fcm.hpp"
+#include "file.hpp"
+#include "prfring.hpp"
+using namespace smashpp;
+
+// Bytes in the largest unit, of those of --max-mem, they make one of at
+// least, to a tenth of it, rounded up. So "--max-mem 1K" reads as 1 KB, and
+// what the models need never reads smaller than it is
+static std::string size_text(uint64_t bytes) {
+  static const std::array<std::string, 5> units{"B", "KB", "MB", "GB", "TB"};
+  size_t u{0};
+  while (u + 1 != units.size() && bytes >> (10u * (u + 1)) != 0) ++u;
+  if (u == 0) return std::to_string(bytes) + " B";
+  const auto unit{1ull << (10u * u)};
+  const auto tenths{bytes / unit * 10 +
+                    ((bytes % unit) * 10 + unit - 1) / unit};
+  return std::to_string(tenths / 10) +
+         (tenths % 10 != 0 ? "." + std::to_string(tenths % 10) : "") + " " +
+         units[u];
+}
+
+MemPlan::MemPlan(std::unique_ptr<Param>& par)
+    : rMs(par->refMs),
+      tMs(par->tarMs),
+      refSize(file_size(par->ref)),
+      tarSize(file_size(par->tar)),
+      redun(!par->noRedun),
+      deep(par->deep) {
+  FCM::set_cont(par, rMs);
+  FCM::set_cont(par, tMs);
+}
+
+void MemPlan::fit(std::unique_ptr<Param>& par) {
+  const auto budget{par->maxMem};
+  for (;;) {
+    for (auto nthr = par->nthr; nthr != 0; --nthr) {
+      if (peak(nthr, 0) > budget) continue;
+      auto batch{par->batchBytes};
+      while (peak(nthr, batch) > budget) batch >>= 1u;
+      const auto pool{std::min(par->poolBytes, budget - peak(nthr, batch))};
+      std::cerr << "[+] Models within " << size_text(budget) << ": "
+                << size_text(peak(nthr, batch)) << " at most, "
+                << static_cast<int>(nthr)
+                << (nthr == 1 ? " thread, " : " threads, ")
+                << size_text(pool) << " kept for reuse\n";
+      par->refMs = rMs;
+      par->tarMs = tMs;
+      par->nthr = nthr;
+      par->batchBytes = batch;
+      par->poolBytes = pool;
+      return;
+    }
+    if (!shrink(par->blockSketch))
+      error("the models need " + size_text(peak(1, 0)) +
+            " at least, more than --max-mem " + size_text(budget) + ".");
+  }
+}
+
+auto MemPlan::set_bytes(const std::vector<MMPar>& Ms, uint64_t n,
+                        bool sparse) const -> uint64_t {
+  uint64_t bytes{0};
+  for (const auto& m : Ms) bytes += FCM::model_bytes(m, n, sparse);
+  return bytes;
+}
+
+// The parts are the segments, whose sizes add up to n at most. Any model
+// takes at least as much per symbol on a shorter part (see Storage), so c
+// equal parts are the worst case of c at a time
+auto MemPlan::at_once(const std::vector<MMPar>& Ms, uint64_t n,
+                      uint64_t c) const -> uint64_t {
+  uint64_t bytes{0};
+  for (uint64_t j = 1; j <= std::min(c, n); ++j)
+    bytes = std::max(bytes, j * set_bytes(Ms, n / j));
+  return bytes;
+}
+
+// A batch of c tasks at most takes "batch" bytes, and the models of the
+// segment that crosses it. Round 3 is run by the tasks of round 2, each on
+// one thread, so in batches of one, as the ref-free compression of their
+// segments. Each filter, of a mode of round 1 or of a task, has its ring
+auto MemPlan::peak(uint8_t nthr, uint64_t batch) const -> uint64_t {
+  const auto batch_of = [&](uint64_t n, uint64_t c) {
+    return std::min(batch + set_bytes(rMs, n), at_once(rMs, n, c));
+  };
+  const auto tasks{std::min<uint64_t>(BATCH_TASKS, nthr)};
+  const auto round1{set_bytes(rMs, refSize, false)};  // Dense, see FCM::store
+  const auto self1{redun ? at_once(tMs, tarSize, nthr) : 0};
+  const auto segMax{deep ? std::max(refSize, tarSize) : refSize};
+  auto task2{redun ? set_bytes(tMs, segMax) : 0};
+  if (deep) task2 = std::max(task2, batch_of(refSize, 1));
+  const auto rings{std::max<uint64_t>(2, tasks) * PRF_RING * sizeof(float)};
+  return rings +
+         std::max({round1, self1, batch_of(tarSize, tasks), nthr * task2});
+}
+
+auto MemPlan::shrink(bool blocked) -> bool {
+  MMPar* largest{nullptr};
+  MMPar next;
+  uint64_t most{0};
+  for (auto Ms : {&rMs, &tMs}) {
+    const auto n{Ms == &rMs ? refSize : tarSize};
+    const bool sparse{Ms != &rMs};  // As in round 1, see peak
+    for (auto& m : *Ms) {
+      MMPar e;
+      const auto bytes{FCM::model_bytes(m, n, sparse)};
+      if (bytes > most && smaller(m, n, blocked, sparse, e)) {
+        largest = &m;
+        next = e;
+        most = bytes;
+      }
+    }
+  }
+  if (largest == nullptr) return false;
+  *largest = next;
+  return true;
+}
+
+// The container of a model of "m", for n symbols, that takes the most bytes
+// less than it does: a table, as far as k allows, a hash table or a sketch,
+// of the depth of m, if a sketch, else D, and n/SYM_PER_W columns at least
+auto MemPlan::smaller(const MMPar& m, uint64_t n, bool blocked, bool sparse,
+                      MMPar& next) -> bool {
+  const auto now{FCM::model_bytes(m, n, sparse)};
+  uint64_t best{0};
+  bool found{false};
+  const auto consider = [&](Container cont, uint64_t w, uint8_t d) {
+    auto e{m};
+    e.cont = cont;
+    e.w = w;
+    e.d = d;
+    const auto bytes{FCM::model_bytes(e, n, sparse)};
+    if (bytes < now && (!found || bytes > best)) {
+      next = e;
+      best = bytes;
+      found = true;
+    }
+  };
+  if (m.k <= K_MAX_TBL64) consider(Container::table_64, 0, 0);
+  if (m.k <= K_MAX_TBL32) consider(Container::table_32, 0, 0);
+  if (m.k <= K_MAX_TBL16) consider(Container::table_16, 0, 0);
+  if (m.k <= K_MAX_LGTBL8) consider(Container::log_table_8, 0, 0);
+  consider(Container::hash_table_16, 0, 0);
+  const auto sketch{blocked ? Container::block_sketch_8 : Container::sketch_8};
+  const auto d{m.d != 0 ? m.d : D};
+  const auto wMin{std::max(W_MIN, n / SYM_PER_W)};
+  for (auto w = W; w >= wMin; w >>= 1u) consider(sketch, w, d);
+  return found;
+}
@@ -0,0 +1,52 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_MEMPLAN_HPP
+#define SMASHPP_MEMPLAN_HPP
+
+#include <memory>
+#include <vector>
+
+#include "mdlpar.hpp"
+#include "par.hpp"
+
+namespace smashpp {
+static constexpr uint64_t W_MIN{1ull << 16};  // Narrowest sketch of a plan
+static constexpr uint64_t SYM_PER_W{4};  // Symbols per column, at most, ditto
+
+// Containers, sketch widths, threads and round 2/3 batches that keep the
+// models of a run within par->maxMem (--max-mem), chosen before any model is
+// allocated. The models alive at once are those of round 1; or of the
+// ref-free compression of its segments, a set per thread; or of a batch of
+// round 2; or, per thread, of the ref-free compression or a batch of round 3
+// of a segment. Each is bounded by the size of the sequence it is built
+// from, so the plan holds whatever the segments turn out to be.
+// The most threads, then the largest batches, that fit are kept, and what
+// is left bounds the models kept for reuse (see ModelPool). If none
+// fit, the largest model is moved to the next smaller container, or a
+// narrower sketch, and so on, until all fit, else the run fails. A sketch
+// narrower than a quarter of its symbols finds few of the segments, so it is
+// not an option
+class MemPlan {
+ public:
+  explicit MemPlan(std::unique_ptr<Param>&);
+  void fit(std::unique_ptr<Param>&);  // Into par->maxMem, or fail
+
+ private:
+  std::vector<MMPar> rMs, tMs;  // Models, as chosen so far
+  uint64_t refSize, tarSize;    // Symbols
+  bool redun;                   // Ref-free compression of the segments
+  bool deep;                    // Round 3
+
+  auto set_bytes(const std::vector<MMPar>&, uint64_t, bool = true) const
+      -> uint64_t;  // Of models for n symbols, sparse if they may be
+  auto at_once(const std::vector<MMPar>&, uint64_t, uint64_t) const
+      -> uint64_t;  // Of tasks on parts of n symbols, at most c at a time
+  auto peak(uint8_t, uint64_t) const -> uint64_t;  // Threads, batch bytes
+  auto shrink(bool) -> bool;  // Largest model, to the next smaller
+  static auto smaller(const MMPar&, uint64_t, bool, bool, MMPar&) -> bool;
+};
+}  // namespace smashpp
+
+#endif  // SMASHPP_MEMPLAN_HPP
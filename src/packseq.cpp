@@ -0,0 +1,30 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "packseq.hpp"
+
+#include "par.hpp"
+using namespace smashpp;
+
+// Replace the content with at least "min_bases" bases of the file (fewer only
+// at its end), skipping new lines. Returns the number of bases loaded.
+uint64_t PackedSeq::load(std::istream& in, uint64_t min_bases) {
+  buf.assign(((min_bases + FILE_READ_BUF) >> 5u) + 1, 0ull);
+  n = 0;
+
+  std::vector<char> buffer(FILE_READ_BUF, 0);
+  while (n < min_bases && in.peek() != EOF) {
+    in.read(buffer.data(), FILE_READ_BUF);
+    for (auto it = std::begin(buffer); it != std::begin(buffer) + in.gcount();
+         ++it) {
+      if (*it != '\n') {
+        buf[n >> 5u] |= static_cast<uint64_t>(base_code(*it))
+                        << ((n & 31u) << 1u);
+        ++n;
+      }
+    }
+  }
+
+  return n;
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_PACKSEQ_HPP
+#define SMASHPP_PACKSEQ_HPP
+
+#include <istream>
+#include <vector>
+
+#include "def.hpp"
+
+namespace smashpp {
+static constexpr uint64_t REF_CHUNK{1ull << 24};  // Bases per ingestion chunk
+
+// Bases packed 2 bits each (32 per word), coded by base_code. It is filled
+// once from the file and then read by any number of models.
+class PackedSeq {
+ public:
+  PackedSeq() : n(0) {}
+  auto load(std::istream&, uint64_t) -> uint64_t;  // Next chunk of a file
+  auto size() const -> uint64_t { return n; }
+  auto operator[](uint64_t i) const -> uint8_t {
+    return static_cast<uint8_t>((buf[i >> 5u] >> ((i & 31u) << 1u)) & 3u);
+  }
+
+ private:
+  std::vector<uint64_t> buf;
+  uint64_t n;  // No. bases
+};
+}  // namespace smashpp
+
+#endif  // SMASHPP_PACKSEQ_HPP
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include "par.hpp"
 #include <algorithm>
+#include <cctype>
 #include <fstream>
 #include <memory>
 #include <vector>
@@ -38,6 +39,35 @@ void Param::parse(int argc, char**& argv) {
     return (iter + 1 <= std::end(vArgs)) && (*iter == name);
   };
 
+  // Values of an option, as "a,b,c". Lists are for -reseg, a run takes the
+  // first
+  const auto values = [](const std::string& arg) {
+    std::vector<std::string> vals;
+    split(std::begin(arg), std::end(arg), ',', vals);
+    return vals;
+  };
+
+  // Bytes of a size as "8G", "512M", "64K" or "512" (M)
+  const auto mem_size = [](const std::string& arg) {
+    size_t end{0};
+    uint64_t size{0};
+    try {
+      size = std::stoull(arg, &end);
+    } catch (std::exception&) {
+      error("incorrect memory size \"" + arg + "\". Use e.g. 8G or 512M.");
+    }
+    const auto unit = end == arg.size() ? 'M' : std::toupper(arg[end]);
+    if (!std::isdigit(arg.front()) || end + 1 < arg.size() || size == 0 ||
+        (unit != 'K' && unit != 'M' && unit != 'G' && unit != 'T'))
+      error("incorrect memory size \"" + arg + "\". Use e.g. 8G or 512M.");
+    const auto shift{unit == 'K'   ? 10u
+                     : unit == 'M' ? 20u
+                     : unit == 'G' ? 30u
+                                   : 40u};
+    if (size > (~0ull >> shift)) error("the memory size is too large.");
+    return size << shift;
+  };
+
   bool man_rm{false};
   bool man_tm{false};
   std::string rModelsPars;
@@ -88,11 +118,15 @@ void Param::parse(int argc, char**& argv) {
           Problem::warning);
       range->assert(level);
     } else if (option_inserted(i, "-m")) {
-      segSize = std::stoul(*++i);
-      auto range = std::make_unique<ValRange<uint32_t>>(
-          MIN_SSIZE, MAX_SSIZE, SSIZE, "Minimum segment size", Interval::closed,
-          "default", Problem::warning);
-      range->assert(segSize);
+      for (const auto& v : values(*++i)) {
+        segSize = std::stoul(v);
+        auto range = std::make_unique<ValRange<uint32_t>>(
+            MIN_SSIZE, MAX_SSIZE, SSIZE, "Minimum segment size",
+            Interval::closed, "default", Problem::warning);
+        range->assert(segSize);
+        segSizes.push_back(segSize);
+      }
+      segSize = segSizes.front();
     } else if (option_inserted(i, "-rm")) {
       man_rm = true;
       rModelsPars = *++i;
@@ -109,18 +143,26 @@ void Param::parse(int argc, char**& argv) {
         parseModelsPars(std::begin(tModelsPars), std::end(tModelsPars), tarMs);
     } else if (option_inserted(i, "-f")) {
       manWSize = true;
-      filt_size = static_cast<uint32_t>(std::stoi(*++i));
-      auto range = std::make_unique<ValRange<uint32_t>>(
-          MIN_WS, MAX_WS, WS, "Filter size", Interval::closed, "default",
-          Problem::warning);
-      range->assert(filt_size);
+      for (const auto& v : values(*++i)) {
+        filt_size = static_cast<uint32_t>(std::stoi(v));
+        auto range = std::make_unique<ValRange<uint32_t>>(
+            MIN_WS, MAX_WS, WS, "Filter size", Interval::closed, "default",
+            Problem::warning);
+        range->assert(filt_size);
+        filtSizes.push_back(filt_size);
+      }
+      filt_size = filtSizes.front();
     } else if (option_inserted(i, "-th")) {
       manThresh = true;
-      thresh = std::stof(*++i);
-      auto range = std::make_unique<ValRange<float>>(
-          MIN_THRSH, MAX_THRSH, THRSH, "Threshold", Interval::open_closed,
-          "default", Problem::warning);
-      range->assert(thresh);
+      for (const auto& v : values(*++i)) {
+        thresh = std::stof(v);
+        auto range = std::make_unique<ValRange<float>>(
+            MIN_THRSH, MAX_THRSH, THRSH, "Threshold", Interval::open_closed,
+            "default", Problem::warning);
+        range->assert(thresh);
+        threshs.push_back(thresh);
+      }
+      thresh = threshs.front();
     } else if (option_inserted(i, "-ft")) {
       const auto is_win_type = [](std::string t) {
         return (t == "0" || t == "rectangular" || t == "1" || t == "hamming" ||
@@ -128,11 +170,14 @@ void Param::parse(int argc, char**& argv) {
                 t == "4" || t == "triangular" || t == "5" || t == "welch" ||
                 t == "6" || t == "sine" || t == "7" || t == "nuttall");
       };
-      const std::string cmd{*++i};
-      auto set = std::make_unique<ValSet<FilterType>>(
-          SET_WTYPE, FT, "Window type", "default", Problem::warning,
-          win_type(cmd), is_win_type(cmd));
-      set->assert(filt_type);
+      for (const auto& cmd : values(*++i)) {
+        auto set = std::make_unique<ValSet<FilterType>>(
+            SET_WTYPE, FT, "Window type", "default", Problem::warning,
+            win_type(cmd), is_win_type(cmd));
+        set->assert(filt_type);
+        filtTypes.push_back(filt_type);
+      }
+      filt_type = filtTypes.front();
     } else if (option_inserted(i, "-e")) {
       entropyN = static_cast<prc_t>(std::stod(*++i));
       auto range = std::make_unique<ValRange<prc_t>>(
@@ -145,6 +190,19 @@ void Param::parse(int argc, char**& argv) {
           MIN_THRD, MAX_THRD, THRD, "Number of threads", Interval::closed,
           "default", Problem::warning);
       range->assert(nthr);
+    } else if (option_inserted(i, "-wu")) {
+      warmUp = static_cast<uint32_t>(std::stoul(*++i));
+      auto range = std::make_unique<ValRange<uint32_t>>(
+          MIN_WARM, MAX_WARM, WARM, "Warm-up", Interval::closed, "default",
+          Problem::warning);
+      range->assert(warmUp);
+    } else if (option_inserted(i, "-hp")) {
+      auto hp = static_cast<uint8_t>(std::stoi(*++i));
+      auto range = std::make_unique<ValRange<uint8_t>>(
+          MIN_PAGES, MAX_PAGES, PAGES, "Huge pages", Interval::closed,
+          "default", Problem::warning);
+      range->assert(hp);
+      pages = static_cast<Pages>(hp);
     } else if (option_inserted(i, "-d")) {
       manSampleStep = true;
       sampleStep = std::stoull(*++i);
@@ -188,12 +246,20 @@ void Param::parse(int argc, char**& argv) {
           std::numeric_limits<int16_t>::max(), 0, "Target ending guard",
           Interval::closed, "default", Problem::warning);
       range->assert(tar_guard->end);
+    } else if (*i == "-reseg") {
+      reseg = true;
     } else if (*i == "-ar") {
       asym_region = true;
     } else if (*i == "-dp") {//todo
       deep = false;
     } else if (*i == "-nr") {
       noRedun = true;
+    } else if (*i == "-bs") {
+      blockSketch = true;
+    } else if (*i == "-ht") {
+      hashTable = true;
+    } else if (*i == "-pt") {
+      packTable = true;
     } else if (*i == "-sb") {
       saveSeq = true;
     } else if (*i == "-sp") {
@@ -204,6 +270,10 @@ void Param::parse(int argc, char**& argv) {
       saveSegment = true;
     } else if (*i == "-sa") {
       saveAll = true;
+    } else if (option_inserted(i, "-mc")) {
+      modelDir = *++i;
+    } else if (option_inserted(i, "--max-mem")) {
+      maxMem = mem_size(*++i);
     }
   }
 
@@ -231,6 +301,15 @@ void Param::parse(int argc, char**& argv) {
     tarMs = refMs;
   }
 
+  const auto n_models = [](const std::vector<MMPar>& Ms) {
+    size_t n{0};
+    for (const auto& mm : Ms) n += mm.child ? 2 : 1;
+    return n;
+  };
+  if (n_models(refMs) > MAX_MDL || n_models(tarMs) > MAX_MDL)
+    error("at most " + std::to_string(MAX_MDL) +
+          " models, tolerant ones included, can be mixed.");
+
   //// manFilterScale = !manThresh;
 
   if (!manSampleStep) {
@@ -238,6 +317,14 @@ void Param::parse(int argc, char**& argv) {
     sampleStep = static_cast<uint64_t>(std::ceil(min_ref_tar / 5000.0));
   }
 
+  if (!reseg && (threshs.size() > 1 || filtSizes.size() > 1 ||
+                 filtTypes.size() > 1 || segSizes.size() > 1))
+    warning("lists of values are for -reseg. The first of each is used.");
+  if (threshs.empty()) threshs.push_back(thresh);
+  if (filtSizes.empty()) filtSizes.push_back(filt_size);
+  if (filtTypes.empty()) filtTypes.push_back(filt_type);
+  if (segSizes.empty()) segSizes.push_back(segSize);
+
   keep_in_range(1ull, filt_size,
                 std::min(file_size(ref), file_size(tar)) / sampleStep);
 }
@@ -295,8 +382,13 @@ void Param::parseModelsPars(Iter begin, Iter end, std::vector<MMPar>& Ms) {
                            static_cast<uint8_t>(std::stoi(m[1])),
                            std::stof(m[2]), std::stof(m[3])));
     } else if (m.size() == 6) {
+      const auto log_w = std::stoi(m[1]);
+      if (log_w < MIN_LOG_W || log_w > MAX_LOG_W)
+        error("the sketch width \"" + m[1] + "\" is out of range. It is " +
+              "log2(w), from " + std::to_string(MIN_LOG_W) + " to " +
+              std::to_string(MAX_LOG_W) + ".");
       Ms.push_back(MMPar(static_cast<uint8_t>(std::stoi(m[0])),
-                         pow2(std::stoull(m[1])),
+                         1ull << log_w,  // w = 2^m[1]
                          static_cast<uint8_t>(std::stoi(m[2])),
                          static_cast<uint8_t>(std::stoi(m[3])), std::stof(m[4]),
                          std::stof(m[5])));
@@ -355,6 +447,11 @@ void Param::help() const {
                   std::to_string(MAX_THRD) + "]",
               delim_def, std::to_string(THRD));
 
+  print_align(bold("-wu"), "INT", delim_descr1,
+              "warm-up (symbols): [" + std::to_string(MIN_WARM) + ", " +
+                  std::to_string(MAX_WARM) + "]",
+              delim_def, std::to_string(WARM));
+
   print_align(bold("-f"), "INT", delim_descr1,
               "filter size: [" + std::to_string(MIN_WS) + ", " +
                   std::to_string(MAX_WS) + "]",
@@ -421,11 +518,26 @@ void Param::help() const {
   print_align(bold("-nr"), delim_descr1, "do NOT compute self complexity",
               delim_def, "no");
 
+  print_align(bold("-bs"), delim_descr1,
+              "blocked sketches: the counters of a", delim_def, "no");
+  print_align("", delim_descr2, "context in one cache line. Faster,");
+  print_align("", delim_descr2, "a little less accurate");
+
+  print_align(bold("-ht"), delim_descr1,
+              "hash tables in place of sketches:", delim_def, "no");
+  print_align("", delim_descr2, "exact counts, memory as the ref");
+  print_align("", delim_descr2, "needs");
+
+  print_align(bold("-pt"), delim_descr1,
+              "packed tables: the counters of a", delim_def, "no");
+  print_align("", delim_descr2, "context in a word, up to k=13.");
+  print_align("", delim_descr2, "Less memory, 16 bit counts");
+
   print_align(bold("-sb"), delim_descr1, "save sequence (input: FASTA/FASTQ)",
               delim_def, "no");
 
-  print_align(bold("-sp"), delim_descr1, "save profile (*.prf)", delim_def,
-              "no");
+  print_align(bold("-sp"), delim_descr1, "save profile (*.prf, binary)",
+              delim_def, "no");
 
   print_align(bold("-sf"), delim_descr1, "save filtered file (*.fil)",
               delim_def, "no");
@@ -437,6 +549,35 @@ void Param::help() const {
               delim_def, "no");
   print_align("", delim_descr2, "segmented files");
 
+  print_align(bold("-reseg"), delim_descr1,
+              "segment the profiles saved by -sp", delim_def, "no");
+  print_align("", delim_descr2, "again, for all combinations of lists");
+  print_align("", delim_descr2, "given to -th, -f, -ft and -m, e.g.,");
+  print_align("", delim_descr2, "-th 1.5,1.7 -ft 0,hann. A summary row");
+  print_align("", delim_descr2, "per combination goes to the output,");
+  print_align("", delim_descr2, "its segments to a file, if -ss. A run");
+  print_align("", delim_descr2, "without -reseg takes the first value");
+  print_align("", delim_descr2, "of each list");
+
+  print_align(bold("-prftxt") + " <FILE>", delim_descr1,
+              "print a profile (*.prf) as text, an");
+  print_align("", delim_descr2, "entropy per line, and exit");
+
+  print_align(bold("-mc"), "DIR", delim_descr1,
+              "cache of reference models (reused", delim_def, "no");
+  print_align("", delim_descr2, "across runs on the same reference)");
+
+  print_align(bold("--max-mem") + " <SIZE>", delim_descr1,
+              "memory of the models, e.g. 8G or", delim_def, "no");
+  print_align("", delim_descr2, "512M (M if no unit). Containers,");
+  print_align("", delim_descr2, "sketch widths, threads and batches");
+  print_align("", delim_descr2, "are chosen to fit, else it fails");
+
+  print_align(bold("-hp"), "INT", delim_descr1,
+              "pages of models: 0=normal,", delim_def,
+              std::to_string(PAGES));
+  print_align("", delim_descr2, "1=transparent huge, 2=explicit huge");
+
   print_line(bold("-rm") + " " + italic("k") + ",[" + italic("w") + "," +
              italic("d") + ",]ir," + italic("a") + "," + italic("g") + "/" +
              italic("t") + ",ir," + italic("a") + "," + italic("g") + ":...");
@@ -450,7 +591,9 @@ void Param::help() const {
   print_align_model("INT", delim_descr2, italic("k") + ":", "context size");
 
   print_align_model("INT", delim_descr2, italic("w") + ":",
-                    "width of sketch in log2 form,");
+                    "width of sketch in log2 form: [" +
+                        std::to_string(MIN_LOG_W) + ", " +
+                        std::to_string(MAX_LOG_W) + "],");
   print_align_model("", delim_descr2, "", "e.g., set 10 for w=2^10=1024");
 
   print_align_model("INT", delim_descr2, italic("d") + ":", "depth of sketch");
@@ -495,6 +638,20 @@ void Param::help() const {
   // // line("There is NO WARRANTY, to the extent permitted by law.");
 }
 
+// Segments of a round are processed at once, each by a task that names its
+// files after its ref and tar and keeps its own messages. The rest is shared
+// by all tasks and not changed
+std::unique_ptr<Param> Param::task(std::string ref_, std::string tar_) const {
+  auto par = std::make_unique<Param>(*this);
+  par->ref = std::move(ref_);
+  par->tar = std::move(tar_);
+  par->refName = file_name(par->ref);
+  par->tarName = file_name(par->tar);
+  par->seq.clear();
+  par->showInfo = false;
+  return par;
+}
+
 FilterType Param::win_type(std::string t) const {
   if (t == "0" || t == "rectangular")
     return FilterType::rectangular;
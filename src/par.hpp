@@ -7,11 +7,18 @@
 
 #include "def.hpp"
 #include "mdlpar.hpp"
+#include "seqview.hpp"
 
 namespace smashpp {
 static constexpr uint8_t MIN_THRD{1};
 static constexpr uint8_t MAX_THRD{255};
 static constexpr uint8_t THRD{4};
+static constexpr uint32_t MIN_WARM{0};
+static constexpr uint32_t MAX_WARM{1u << 24};
+static constexpr uint32_t WARM{10000};  // Warm-up of parallel compression
+static constexpr uint8_t MIN_PAGES{0};
+static constexpr uint8_t MAX_PAGES{2};
+static constexpr uint8_t PAGES{1};  // Pages of models, as Pages
 static constexpr uint8_t MIN_LVL{0};
 static constexpr uint8_t MAX_LVL{6};
 static constexpr uint8_t LVL{3};
@@ -29,11 +36,16 @@ static constexpr auto SAMPLE_STEP{1ull};
 static constexpr float MIN_THRSH{0};
 static constexpr float MAX_THRSH{20};
 static constexpr float THRSH{1.5};
+static constexpr uint64_t BATCH_BYTES{1ull << 30};  // Models, round 2/3 batch
+static constexpr uint64_t POOL_BYTES{1ull << 30};   // Models kept for reuse
 static constexpr uint8_t K_MAX_TBL64{11};   // Max ctx table 64     (128 MB mem)
+static constexpr uint8_t K_MAX_TBL16{13};   // Max ctx table 16     (512 MB mem)
 static constexpr uint8_t K_MAX_TBL32{13};   // Max ctx table 32     (1   GB mem)
 static constexpr uint8_t K_MAX_LGTBL8{14};  // Max ctx log table 8  (1   GB mem)
 static constexpr uint64_t W{2 << 29ull};    // Width of CML sketch
 static constexpr uint8_t D{5};              // Depth of CML sketch
+static constexpr uint8_t MIN_LOG_W{1};      // Of CML sketch, k,log2(w),d,...
+static constexpr uint8_t MAX_LOG_W{40};     // (2^40 = 1 T cells)
 static const std::string LBL_BAK{"_bk"};    // Label  - backup files
 static const std::string POS_WATERMARK{"##SMASH++"};  // Hdr of pos file
 static constexpr size_t FILE_READ_BUF{8 * 1024};  // 8K
@@ -73,10 +85,17 @@ class Param {
   uint32_t segSize;
   prc_t entropyN;
   uint8_t nthr;
+  uint32_t warmUp;  // Symbols before each chunk of parallel compression
+  Pages pages;
   uint32_t filt_size;
   FilterType filt_type;
   uint64_t sampleStep;
   float thresh;
+  bool reseg;  // Segment the saved profiles again, by all of these:
+  std::vector<float> threshs;
+  std::vector<uint32_t> filtSizes;
+  std::vector<FilterType> filtTypes;
+  std::vector<uint32_t> segSizes;
   bool man_level, manWSize, manThresh, manSampleStep, manFilterScale;
   FilterScale filterScale;
   bool saveSeq, saveProfile, saveFilter, saveSegment, saveAll;
@@ -89,7 +108,14 @@ class Param {
   bool noRedun;
   bool deep;
   bool asym_region;
+  bool blockSketch;  // Sketches blocked by cache line (BlockCMLS4)
+  bool hashTable;    // Hash tables in place of sketches (HashTable16)
+  bool packTable;    // Packed tables in place of tables (Table16)
+  uint64_t maxMem;      // Budget of the models (bytes), 0 if none (MemPlan)
+  uint64_t batchBytes;  // Models of a round 2/3 batch, at most
+  uint64_t poolBytes;   // Models kept for reuse, at most (see ModelPool)
   std::vector<MMPar> refMs, tarMs;
+  std::string modelDir;  // Cache of reference models, empty if none
   std::string message;
   std::string param_list;
 
@@ -103,8 +129,9 @@ class Param {
     int16_t end;
     RefGuard() : beg(0), end(0) {}
   };
-  std::unique_ptr<TarGuard> tar_guard;
-  std::unique_ptr<RefGuard> ref_guard;
+  std::shared_ptr<TarGuard> tar_guard;  // Set by parse, then only read
+  std::shared_ptr<RefGuard> ref_guard;
+  std::shared_ptr<SeqViews> views;  // Segments, shared by all tasks
 
   Param()  // Define Param::Param(){} in *.hpp => compile error
       : verbose(false),
@@ -112,10 +139,13 @@ class Param {
         segSize(SSIZE),
         entropyN(ENTR_N),
         nthr(THRD),
+        warmUp(WARM),
+        pages(static_cast<Pages>(PAGES)),
         filt_size(WS),
         filt_type(FT),
         sampleStep(SAMPLE_STEP),
         thresh(THRSH),
+        reseg(false),
         manWSize(false),
         manThresh(false),
         manSampleStep(false),
@@ -134,10 +164,19 @@ class Param {
         deep(true),
         // deep(false),
         asym_region(false),
-        tar_guard(std::make_unique<TarGuard>()),
-        ref_guard(std::make_unique<RefGuard>()) {}
+        blockSketch(false),
+        hashTable(false),
+        packTable(false),
+        maxMem(0),
+        batchBytes(BATCH_BYTES),
+        poolBytes(POOL_BYTES),
+        tar_guard(std::make_shared<TarGuard>()),
+        ref_guard(std::make_shared<RefGuard>()),
+        views(std::make_shared<SeqViews>()) {}
 
   void parse(int, char**&);
+  auto task(std::string, std::string) const
+      -> std::unique_ptr<Param>;  // Own copy, for a ref and a tar
   auto win_type(std::string) const -> FilterType;
   auto print_win_type() const -> std::string;
   auto filter_scale(std::string) const -> FilterScale;
@@ -0,0 +1,99 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_PIPELINE_HPP
+#define SMASHPP_PIPELINE_HPP
+
+#include <memory>
+#include <tuple>
+
+#include "bcmls4.hpp"
+#include "cmls4.hpp"
+#include "hashtbl16.hpp"
+#include "logtbl8.hpp"
+#include "tbl16.hpp"
+#include "tbl32.hpp"
+#include "tbl64.hpp"
+
+namespace smashpp {
+// A model of a pipeline: its container and whether it has a tolerant model
+template <typename Cont, bool TM>
+struct Stage {
+  using cont_t = Cont;
+  static constexpr bool tm{TM};
+};
+
+// Models mixed in compression, known at compile time, so that no switch on
+// the container, no copy of the model parameters and no walk of iterators is
+// left per symbol. Bound to the containers of a model set that matches it
+template <typename... Stages>
+struct Pipeline {
+  std::tuple<const std::unique_ptr<typename Stages::cont_t>*...> conts;
+};
+
+// Any other set of models, e.g. by "-rm" or "-tm", mixed as given at run time
+struct AnyPipeline {};
+
+// Model sets of the levels with more than one model (def.hpp). A single
+// model, as set by Param::set_auto_model_par, is compressed by compress_1.
+// With blocked sketches ("-bs"), the levels with a sketch are the B ones, and
+// with hash tables ("-ht"), the H ones. With packed tables ("-pt"), the
+// tables are Table16, in the P ones
+using PipelineLvl2 = Pipeline<Stage<LogTable8, false>, Stage<Table64, false>>;
+using PipelineLvl3 = Pipeline<Stage<LogTable8, true>>;
+using PipelineLvl4 = Pipeline<Stage<CMLS4, true>, Stage<Table32, false>,
+                              Stage<Table64, false>>;
+using PipelineLvl56 =
+    Pipeline<Stage<CMLS4, true>, Stage<LogTable8, true>, Stage<Table64, false>,
+             Stage<Table64, false>>;
+using PipelineLvl4B = Pipeline<Stage<BlockCMLS4, true>, Stage<Table32, false>,
+                               Stage<Table64, false>>;
+using PipelineLvl56B =
+    Pipeline<Stage<BlockCMLS4, true>, Stage<LogTable8, true>,
+             Stage<Table64, false>, Stage<Table64, false>>;
+using PipelineLvl4H = Pipeline<Stage<HashTable16, true>,
+                               Stage<Table32, false>, Stage<Table64, false>>;
+using PipelineLvl56H =
+    Pipeline<Stage<HashTable16, true>, Stage<LogTable8, true>,
+             Stage<Table64, false>, Stage<Table64, false>>;
+using PipelineLvl2P = Pipeline<Stage<LogTable8, false>, Stage<Table16, false>>;
+using PipelineLvl4P = Pipeline<Stage<CMLS4, true>, Stage<Table16, false>,
+                               Stage<Table16, false>>;
+using PipelineLvl56P =
+    Pipeline<Stage<CMLS4, true>, Stage<LogTable8, true>, Stage<Table16, false>,
+             Stage<Table16, false>>;
+
+template <typename Cont>
+constexpr Container cont_kind();
+template <>
+constexpr Container cont_kind<Table64>() {
+  return Container::table_64;
+}
+template <>
+constexpr Container cont_kind<Table32>() {
+  return Container::table_32;
+}
+template <>
+constexpr Container cont_kind<Table16>() {
+  return Container::table_16;
+}
+template <>
+constexpr Container cont_kind<LogTable8>() {
+  return Container::log_table_8;
+}
+template <>
+constexpr Container cont_kind<CMLS4>() {
+  return Container::sketch_8;
+}
+template <>
+constexpr Container cont_kind<BlockCMLS4>() {
+  return Container::block_sketch_8;
+}
+template <>
+constexpr Container cont_kind<HashTable16>() {
+  return Container::hash_table_16;
+}
+}  // namespace smashpp
+
+#endif  // SMASHPP_PIPELINE_HPP
\ No newline at end of file
@@ -0,0 +1,241 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "prffile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "exception.hpp"
+#include "number.hpp"
+using namespace smashpp;
+
+static constexpr char PRF_MAGIC[8]{'S', 'M', 'A', 'S', 'H', 'P', 'R', 'F'};
+static constexpr uint64_t PRF_LENGTH_POS{20};  // Of the length, in the header
+static constexpr int PRF_MANTISSAS{900};       // 100 ... 999
+
+// Digits m, for m / 10^s, s <= 10, of a positive entropy with PRF_DIGITS
+// significant digits. They are rounded as by printf, since e * 10^s is exact
+// enough, but near a tie. m may be 10^PRF_DIGITS. False if it is not done so
+inline static bool fast_digits(prc_t e, int& m, int& s) {
+  const auto lo = static_cast<prc_t>(POW10[PRF_DIGITS - 1]);
+  if (!(e > 0 && e < POW10[PRF_DIGITS])) return false;
+  s = 0;
+  auto t = e;
+  while (t < lo && s != 10) t = e * POW10[++s];
+  if (t < lo || std::fabs(t - std::floor(t) - 0.5) <= 1e-9) return false;
+  m = static_cast<int>(std::nearbyint(t));
+  return true;
+}
+
+inline static uint16_t code_of(int m, int s) {
+  if (s < PRF_MIN_EXP) return code_of(999, PRF_MIN_EXP);
+  if (s > PRF_MAX_EXP) return code_of(100, PRF_MAX_EXP);
+  return static_cast<uint16_t>(1 + (s - PRF_MIN_EXP) * PRF_MANTISSAS + m -
+                               100);
+}
+
+// m / 10^s is rounded to float as by strtof, since both are exact, for
+// s <= 10. Near a tie, or out of range, it is done by the text
+auto smashpp::prf_value(prc_t e) -> float {
+  int m, s;
+  if (fast_digits(e, m, s))
+    return static_cast<float>(m) / static_cast<float>(POW10[s]);
+  return std::stof(precision(PRF_DIGITS, e));
+}
+
+auto smashpp::prf_code(prc_t e) -> uint16_t {
+  int m, s;
+  if (!fast_digits(e, m, s)) {  // By the text, whose digits are exact
+    const auto v = std::strtod(precision(PRF_DIGITS, e).c_str(), nullptr);
+    if (!(v > 0)) return 0;
+    s = PRF_DIGITS - 1 - static_cast<int>(std::floor(std::log10(v)));
+    m = static_cast<int>(std::nearbyint(v * std::pow(10.0, s)));
+  }
+  if (m == static_cast<int>(POW10[PRF_DIGITS])) {
+    m /= 10;
+    --s;
+  }
+  return code_of(m, s);
+}
+
+// Of all codes, made once
+auto smashpp::prf_decode(uint16_t code) -> float {
+  static const std::vector<float> values = [] {
+    std::vector<float> v(code_of(999, PRF_MAX_EXP) + 1, 0.0f);
+    for (int s = PRF_MIN_EXP; s <= PRF_MAX_EXP; ++s)
+      for (int m = 100; m != 1000; ++m) {
+        const auto digits{std::to_string(m) + "e" + std::to_string(-s)};
+        v[code_of(m, s)] = std::strtof(digits.c_str(), nullptr);
+      }
+    return v;
+  }();
+  return code < values.size() ? values[code] : values.back();
+}
+
+template <typename T>
+inline static void put(std::vector<char>& out, T value) {
+  for (size_t i = 0; i != sizeof(T); ++i)
+    out.push_back(static_cast<char>((static_cast<uint64_t>(value) >> 8 * i) &
+                                    0xFF));
+}
+
+inline static void put(std::vector<char>& out, const std::string& str) {
+  put(out, static_cast<uint32_t>(str.size()));
+  out.insert(std::end(out), std::begin(str), std::end(str));
+}
+
+template <typename T>
+inline static T get(std::istream& in) {
+  unsigned char bytes[sizeof(T)]{};
+  in.read(reinterpret_cast<char*>(bytes), sizeof(T));
+  uint64_t value{0};
+  for (size_t i = 0; i != sizeof(T); ++i)
+    value |= static_cast<uint64_t>(bytes[i]) << 8 * i;
+  return static_cast<T>(value);
+}
+
+inline static std::string get_string(std::istream& in) {
+  std::string str(get<uint32_t>(in), '\0');
+  in.read(&str[0], static_cast<std::streamsize>(str.size()));
+  return str;
+}
+
+void ProfileWriter::open(const std::string& name, const ProfileHeader& h) {
+  header = h;
+  header.length = 0;
+  codes.clear();
+  index.clear();
+  file.open(name, std::ios::binary);
+  if (!file) error("the file \"" + name + "\" cannot be written.");
+
+  buf.assign(std::begin(PRF_MAGIC), std::end(PRF_MAGIC));
+  put(buf, PRF_VERSION);
+  put(buf, PRF_DIGITS);
+  put(buf, header.ir);
+  put(buf, header.sampleStep);
+  put(buf, header.length);
+  put(buf, uint64_t{0});  // Index
+  put(buf, header.ref);
+  put(buf, header.tar);
+  put(buf, header.models);
+  file.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+  codes.reserve(PRF_BLOCK);
+}
+
+void ProfileWriter::write(const std::vector<prc_t>& entropies) {
+  for (auto e : entropies) {
+    codes.push_back(prf_code(e));
+    if (codes.size() == PRF_BLOCK) put_block();
+  }
+  header.length += entropies.size();
+}
+
+// A code repeated more than twice is kept once, then PRF_RUN and its run
+void ProfileWriter::put_block() {
+  static_assert(PRF_BLOCK <= 1ull << 16, "a run must fit in 16 bits");
+  index.push_back(static_cast<uint64_t>(file.tellp()));
+  buf.clear();
+  for (size_t i = 0; i != codes.size();) {
+    auto j = i + 1;
+    while (j != codes.size() && codes[j] == codes[i]) ++j;
+    const auto run = j - i - 1;
+    put(buf, codes[i]);
+    if (run > 2) {
+      put(buf, PRF_RUN);
+      put(buf, static_cast<uint16_t>(run));
+    } else {
+      for (size_t k = 0; k != run; ++k) put(buf, codes[i]);
+    }
+    i = j;
+  }
+  file.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+  codes.clear();
+}
+
+void ProfileWriter::close() {
+  if (!file.is_open()) return;
+  if (!codes.empty()) put_block();
+  const auto indexPos = static_cast<uint64_t>(file.tellp());
+  index.push_back(indexPos);
+  buf.clear();
+  for (auto offset : index) put(buf, offset);
+  file.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+
+  buf.clear();
+  put(buf, header.length);
+  put(buf, indexPos);
+  file.seekp(PRF_LENGTH_POS);
+  file.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+  file.close();
+}
+
+ProfileReader::ProfileReader(const std::string& name_)
+    : name(name_), file(name_, std::ios::binary), blockNo(~0ull) {
+  char magic[sizeof(PRF_MAGIC)]{};
+  file.read(magic, sizeof(magic));
+  if (!file || std::memcmp(magic, PRF_MAGIC, sizeof(magic)) != 0)
+    error("the file \"" + name + "\" is not a profile.");
+  if (get<uint16_t>(file) > PRF_VERSION || get<uint8_t>(file) != PRF_DIGITS)
+    error("the profile \"" + name + "\" is of an unknown version.");
+  header.ir = get<uint8_t>(file);
+  header.sampleStep = get<uint64_t>(file);
+  header.length = get<uint64_t>(file);
+  const auto indexPos = get<uint64_t>(file);
+  header.ref = get_string(file);
+  header.tar = get_string(file);
+  header.models = get_string(file);
+
+  file.seekg(static_cast<std::streamoff>(indexPos));
+  index.resize((header.length + PRF_BLOCK - 1) / PRF_BLOCK + 1);
+  for (auto& offset : index) offset = get<uint64_t>(file);
+  if (!file || index.back() != indexPos)
+    error("the profile \"" + name + "\" is cut short.");
+}
+
+void ProfileReader::get_block(uint64_t b) {
+  if (b == blockNo) return;
+  blockNo = ~0ull;
+  buf.resize(index[b + 1] - index[b]);
+  file.clear();
+  file.seekg(static_cast<std::streamoff>(index[b]));
+  file.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+
+  block.clear();
+  const auto bytes = reinterpret_cast<const unsigned char*>(buf.data());
+  const auto code_at = [&](size_t i) {
+    return static_cast<uint16_t>(bytes[i] | bytes[i + 1] << 8);
+  };
+  for (size_t i = 0; i + 1 < buf.size(); i += 2) {
+    const auto code = code_at(i);
+    if (code == PRF_RUN && !block.empty() && i + 3 < buf.size()) {
+      i += 2;
+      block.insert(std::end(block), code_at(i), block.back());
+    } else {
+      block.push_back(prf_decode(code));
+    }
+  }
+  if (!file ||
+      block.size() != std::min(PRF_BLOCK, header.length - b * PRF_BLOCK))
+    error("the profile \"" + name + "\" is cut short.");
+  blockNo = b;
+}
+
+void ProfileReader::read(uint64_t beg, uint64_t size,
+                         std::vector<float>& values) {
+  beg = std::min(beg, header.length);
+  size = std::min(size, header.length - beg);
+  values.clear();
+  values.reserve(size);
+  while (size != 0) {
+    get_block(beg / PRF_BLOCK);
+    const auto first = std::begin(block) + beg % PRF_BLOCK;
+    const auto n = std::min<uint64_t>(size, std::end(block) - first);
+    values.insert(std::end(values), first, first + n);
+    beg += n;
+    size -= n;
+  }
+}
@@ -0,0 +1,87 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_PRFFILE_HPP
+#define SMASHPP_PRFFILE_HPP
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "def.hpp"
+
+namespace smashpp {
+static constexpr uint8_t PRF_DIGITS{3};      // Significant, of an entropy
+static constexpr int PRF_MIN_EXP{-3};        // Of an entropy, m / 10^s, ...
+static constexpr int PRF_MAX_EXP{68};        // ... s in [min, max]
+static constexpr uint16_t PRF_VERSION{1};    // Of the profile file
+static constexpr uint64_t PRF_BLOCK{1 << 16};  // Entropies of a block
+static constexpr uint16_t PRF_RUN{0xFFFF};     // Code: run of the one before
+
+// Of a profile: what made it, and how many entropies it has
+struct ProfileHeader {
+  uint8_t ir;           // Mode: 0 regular, 1 inverted, 2 both
+  uint64_t sampleStep;  // An entropy per sampleStep bases of the target
+  uint64_t length;      // Entropies
+  std::string ref;
+  std::string tar;
+  std::string models;  // Ref models, as -rm: k,log2 w,d,ir,alpha,gamma/...
+
+  ProfileHeader() : ir(0), sampleStep(1), length(0) {}
+};
+
+// A profile file (".prf"). Each entropy, as PRF_DIGITS significant digits m
+// of m / 10^s, is a 16-bit code, so it keeps all that the text one had, and
+// the filter gets from it the float it got from the text. The codes go in
+// blocks of PRF_BLOCK, where a code repeated is kept once, with its run, as
+// the entropies are flat wherever the target is not like the ref. An index of
+// the blocks gives any range with no need to read the ones before. All is
+// little-endian:
+//   "SMASHPRF", version (u16), digits (u8), ir (u8), sampleStep (u64),
+//   length (u64), index (u64), ref, tar, models (each u32 size and chars),
+//   blocks: codes (u16), 0 is 0, 1 + (s - PRF_MIN_EXP) * 900 + m - 100 is
+//     m / 10^s, and PRF_RUN, n (u16) is the code before, n more times,
+//   index: offset (u64) of each block, and of the index.
+// Entropies out of range are saturated.
+auto prf_value(prc_t) -> float;  // As the filter gets it
+auto prf_code(prc_t) -> uint16_t;
+auto prf_decode(uint16_t) -> float;  // As strtof of the digits
+
+class ProfileWriter {
+ public:
+  void open(const std::string&, const ProfileHeader&);
+  auto is_open() const -> bool { return file.is_open(); }
+  void write(const std::vector<prc_t>&);
+  void close();  // Puts the last block, index and length
+
+ private:
+  std::ofstream file;
+  ProfileHeader header;
+  std::vector<uint16_t> codes;  // Of the block being made
+  std::vector<uint64_t> index;
+  std::vector<char> buf;
+
+  void put_block();
+};
+
+class ProfileReader {
+ public:
+  explicit ProfileReader(const std::string&);
+  auto info() const -> const ProfileHeader& { return header; }
+  void read(uint64_t, uint64_t, std::vector<float>&);  // Beg, size: any range
+
+ private:
+  std::string name;
+  std::ifstream file;
+  ProfileHeader header;
+  std::vector<uint64_t> index;
+  std::vector<float> block;  // Last read
+  uint64_t blockNo;
+  std::vector<char> buf;
+
+  void get_block(uint64_t);
+};
+}  // namespace smashpp
+
+#endif  // SMASHPP_PRFFILE_HPP
@@ -0,0 +1,83 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "prfring.hpp"
+
+#include <algorithm>
+using namespace smashpp;
+
+ProfileRing::ProfileRing()
+    : buf(PRF_RING),
+      head(0),
+      size(0),
+      pushed(0),
+      closed(false),
+      gotIdx(0),
+      whole(nullptr),
+      at(0) {}
+
+ProfileRing::ProfileRing(const std::vector<float>& prf)
+    : head(0),
+      size(0),
+      pushed(prf.size()),
+      closed(true),
+      gotIdx(0),
+      whole(&prf),
+      at(0) {}
+
+void ProfileRing::push(const std::vector<float>& ent) {
+  for (size_t i = 0; i != ent.size();) {
+    std::unique_lock<std::mutex> lock(mut);
+    notFull.wait(lock, [&] { return closed || size != buf.size(); });
+    if (closed) return;
+    const auto n = std::min<uint64_t>(ent.size() - i, buf.size() - size);
+    for (uint64_t j = 0; j != n; ++j)
+      buf[(head + size + j) % buf.size()] = ent[i + j];
+    size += n;
+    pushed += n;
+    i += n;
+    lock.unlock();
+    notEmpty.notify_one();
+  }
+}
+
+void ProfileRing::close() {
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    closed = true;
+  }
+  notFull.notify_one();
+  notEmpty.notify_one();
+}
+
+// All the entropies in the ring are taken at once, to lock once per many
+auto ProfileRing::next(float& e) -> bool {
+  if (whole != nullptr) {
+    if (at == whole->size()) return false;
+    e = (*whole)[at++];
+    return true;
+  }
+  if (gotIdx == got.size()) {
+    got.clear();
+    gotIdx = 0;
+    std::unique_lock<std::mutex> lock(mut);
+    notEmpty.wait(lock, [&] { return closed || size != 0; });
+    if (size == 0) return false;
+    for (; size != 0; --size, head = (head + 1) % buf.size())
+      got.push_back(buf[head]);
+    lock.unlock();
+    notFull.notify_one();
+  }
+  e = got[gotIdx++];
+  return true;
+}
+
+void ProfileRing::skip(uint64_t n) {
+  if (whole != nullptr) {
+    at += std::min<uint64_t>(n, whole->size() - at);
+    return;
+  }
+  for (float e; n != 0 && next(e); --n) {
+  }
+}
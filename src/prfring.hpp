@@ -0,0 +1,48 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_PRFRING_HPP
+#define SMASHPP_PRFRING_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace smashpp {
+static constexpr uint64_t PRF_RING{1ull << 18};  // Entropies, profile ring
+
+// Entropies of a profile, from the thread that compresses the target to the
+// one that filters and segments it, instead of through the profile file. It is
+// bounded: the compressor waits while it is full, the filter while it is
+// empty. The compressor closes it at the end of the profile; the filter, if it
+// fails, after which the entropies pushed are dropped. A ring over a whole
+// profile is only a cursor on it, so the rings of many filters share one
+// profile, which has to outlive them.
+class ProfileRing {
+ public:
+  ProfileRing();
+  explicit ProfileRing(const std::vector<float>&);  // A whole profile, closed
+  void push(const std::vector<float>&);  // By the compressor
+  void close();
+  auto next(float&) -> bool;  // By the filter; false at the end
+  void skip(uint64_t);
+  auto count() const -> uint64_t { return pushed; }  // Once closed
+
+ private:
+  std::vector<float> buf;
+  uint64_t head;  // First not taken
+  uint64_t size;  // Not taken
+  uint64_t pushed;
+  bool closed;
+  std::mutex mut;
+  std::condition_variable notFull, notEmpty;
+  std::vector<float> got;  // Taken by the filter, in one go
+  size_t gotIdx;
+  const std::vector<float>* whole;  // Read in place, if any
+  uint64_t at;                      // Of whole, next to read
+};
+}  // namespace smashpp
+
+#endif  // SMASHPP_PRFRING_HPP
@@ -0,0 +1,97 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "sched.hpp"
+
+#include <algorithm>
+using namespace smashpp;
+
+namespace {
+thread_local size_t queueIdx{0};  // Of the thread; 0 if not a worker
+}
+
+Scheduler::Scheduler(uint8_t nThr) : pending(0), stop(false) {
+  const auto n = std::max<size_t>(nThr, 1);
+  for (size_t t = 0; t != n; ++t) queues.push_back(std::make_unique<Queue>());
+  for (size_t t = 1; t != n; ++t)
+    workers.emplace_back(&Scheduler::work, this, t);
+}
+
+Scheduler::~Scheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    stop = true;
+  }
+  cv.notify_all();
+  for (auto& w : workers) w.join();
+}
+
+auto Scheduler::self() const -> size_t {
+  return (queueIdx < queues.size()) ? queueIdx : 0;
+}
+
+void Scheduler::push(std::vector<Task>& tasks) {
+  auto& q = *queues[self()];
+  {
+    std::lock_guard<std::mutex> lock(q.mut);
+    q.tasks.insert(std::end(q.tasks), std::begin(tasks), std::end(tasks));
+  }
+  pending += tasks.size();
+  wake();
+}
+
+// The own queue first, then those of the others, starting from the next one
+auto Scheduler::take(const Batch* batch, Task& task) -> bool {
+  const auto me = self();
+  for (size_t t = 0; t != queues.size(); ++t)
+    if (take_from(*queues[(me + t) % queues.size()], batch, task)) return true;
+  return false;
+}
+
+// The most costly task, the first made if equal
+auto Scheduler::take_from(Queue& q, const Batch* batch, Task& task) -> bool {
+  std::lock_guard<std::mutex> lock(q.mut);
+  auto best = std::end(q.tasks);
+  for (auto it = std::begin(q.tasks); it != std::end(q.tasks); ++it)
+    if ((batch == nullptr || it->batch == batch) &&
+        (best == std::end(q.tasks) || it->cost > best->cost))
+      best = it;
+  if (best == std::end(q.tasks)) return false;
+  task = *best;
+  q.tasks.erase(best);
+  --pending;
+  --task.batch->queued;
+  return true;
+}
+
+void Scheduler::execute(const Task& task) {
+  auto& batch = *task.batch;
+  try {
+    batch.fn(task.i);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(batch.errMut);
+    if (!batch.err) batch.err = std::current_exception();
+  }
+  --batch.left;  // The batch may be gone after this, if it was the last task
+  wake();
+}
+
+// Under the lock, so that no thread misses it between testing and waiting
+void Scheduler::wake() {
+  { std::lock_guard<std::mutex> lock(mut); }
+  cv.notify_all();
+}
+
+void Scheduler::work(size_t idx) {
+  queueIdx = idx;
+  for (Task task;;) {
+    if (take(nullptr, task)) {
+      execute(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mut);
+    cv.wait(lock, [&] { return stop || pending != 0; });
+    if (stop) return;
+  }
+}
@@ -0,0 +1,101 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_SCHED_HPP
+#define SMASHPP_SCHED_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace smashpp {
+// Pool of threads for the segments of rounds 1, 2 and 3, which make a tree:
+// each segment of a round is a task, which may run the tasks of its own
+// segments. Each thread has a queue of tasks; a thread with none steals from
+// the others. The most costly task is taken first, so the large segments do
+// not start last. A thread waiting for the tasks it has made runs them,
+// meanwhile, but no others, so a task never waits for one below it in its
+// own stack.
+class Scheduler {
+ public:
+  explicit Scheduler(uint8_t nThr = 1);  // The caller is one of the threads
+  ~Scheduler();
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+  template <typename Cost, typename Fn>
+  void parallel(uint64_t, Cost, Fn);
+
+ private:
+  struct Batch {  // Tasks made by one call to parallel
+    std::function<void(uint64_t)> fn;
+    std::atomic<uint64_t> queued;  // Not taken yet
+    std::atomic<uint64_t> left;    // Not done yet
+    std::exception_ptr err;        // First thrown by a task
+    std::mutex errMut;
+  };
+  struct Task {
+    uint64_t cost;
+    uint64_t i;
+    Batch* batch;
+  };
+  struct Queue {
+    std::mutex mut;
+    std::vector<Task> tasks;
+  };
+  std::vector<std::unique_ptr<Queue>> queues;  // Of the caller, then workers
+  std::vector<std::thread> workers;
+  std::atomic<uint64_t> pending;  // Tasks in all queues
+  bool stop;
+  std::mutex mut;  // Threads with nothing to do wait on cv
+  std::condition_variable cv;
+
+  void push(std::vector<Task>&);
+  auto take(const Batch*, Task&) -> bool;  // Tasks of a batch, or any if null
+  auto take_from(Queue&, const Batch*, Task&) -> bool;
+  void execute(const Task&);
+  void wake();
+  void work(size_t);
+  auto self() const -> size_t;  // Queue of the calling thread
+};
+
+// Run fn(i) for i in [0, n), i.e., n tasks, and return when all are done.
+// cost(i) estimates the work of task i. Tasks must not depend on the order
+// they run in: each writes its results to its own place, for the caller to
+// gather in order. The first exception thrown by a task is thrown again.
+template <typename Cost, typename Fn>
+inline void Scheduler::parallel(uint64_t n, Cost cost, Fn fn) {
+  if (n == 0) return;
+  if (queues.size() == 1) {  // One thread, in order
+    for (uint64_t i = 0; i != n; ++i) fn(i);
+    return;
+  }
+
+  Batch batch;
+  batch.fn = fn;
+  batch.queued = n;
+  batch.left = n;
+  std::vector<Task> tasks;
+  tasks.reserve(n);
+  for (uint64_t i = 0; i != n; ++i)
+    tasks.push_back(Task{static_cast<uint64_t>(cost(i)), i, &batch});
+  push(tasks);
+
+  for (Task task; batch.left != 0;) {
+    if (take(&batch, task)) {
+      execute(task);
+    } else {
+      std::unique_lock<std::mutex> lock(mut);
+      cv.wait(lock, [&] { return batch.left == 0 || batch.queued != 0; });
+    }
+  }
+  if (batch.err) std::rethrow_exception(batch.err);
+}
+}  // namespace smashpp
+
+#endif  // SMASHPP_SCHED_HPP
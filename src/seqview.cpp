@@ -0,0 +1,117 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "seqview.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "file.hpp"
+using namespace smashpp;
+
+SeqViews::Map::Map(const std::string& name)
+    : base(nullptr), ptr(nullptr), n(file_size(name)) {
+  if (n == 0) return;
+#ifndef _WIN32
+  const int fd = ::open(name.c_str(), O_RDONLY);
+  if (fd != -1) {
+    void* addr = ::mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr != MAP_FAILED) {
+      ::madvise(addr, n, MADV_SEQUENTIAL);
+      base = addr;
+      ptr = static_cast<const char*>(addr);
+      return;
+    }
+  }
+#endif
+  copy.resize(n);
+  std::ifstream f(name, std::ios::binary);
+  f.read(copy.data(), static_cast<std::streamsize>(n));
+  ptr = copy.data();
+}
+
+SeqViews::Map::~Map() {
+#ifndef _WIN32
+  if (base) ::munmap(base, n);
+#endif
+}
+
+SeqViews::Buf::Buf(const View& v) : map(v.map) {
+  auto first = const_cast<char*>(map->data()) + v.beg;
+  setg(first, first, first + v.size);
+}
+
+auto SeqViews::Buf::seekoff(off_type off, std::ios_base::seekdir dir,
+                            std::ios_base::openmode which) -> pos_type {
+  if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+  const auto cur = (dir == std::ios_base::beg)   ? 0
+                   : (dir == std::ios_base::cur) ? gptr() - eback()
+                                                 : egptr() - eback();
+  const auto pos = cur + off;
+  if (pos < 0 || pos > egptr() - eback()) return pos_type(off_type(-1));
+  setg(eback(), eback() + pos, egptr());
+  return pos_type(pos);
+}
+
+auto SeqViews::Buf::seekpos(pos_type pos, std::ios_base::openmode which)
+    -> pos_type {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+// A view of a view is one of the file the latter comes from
+void SeqViews::add(const std::string& name, const std::string& src,
+                   uint64_t beg, uint64_t size) {
+  std::lock_guard<std::mutex> lock(mut);
+  View v;
+  const auto in = views.find(src);
+  if (in != std::end(views)) {
+    v = in->second;
+  } else {
+    auto map = maps[src].lock();
+    if (!map) {
+      map = std::make_shared<const Map>(src);
+      maps[src] = map;
+    }
+    v = View{map, 0, map->size()};
+  }
+  beg = std::min(beg, v.size);
+  views[name] = View{v.map, v.beg + beg, std::min(size, v.size - beg)};
+}
+
+void SeqViews::remove(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mut);
+  views.erase(name);
+}
+
+auto SeqViews::find(const std::string& name, View& v) const -> bool {
+  std::lock_guard<std::mutex> lock(mut);
+  const auto it = views.find(name);
+  if (it == std::end(views)) return false;
+  v = it->second;
+  return true;
+}
+
+auto SeqViews::size(const std::string& name) const -> uint64_t {
+  View v;
+  return find(name, v) ? v.size : file_size(name);
+}
+
+auto SeqViews::open(const std::string& name) const
+    -> std::unique_ptr<std::istream> {
+  View v;
+  if (find(name, v)) return std::make_unique<Stream>(v);
+  return std::make_unique<std::ifstream>(name);
+}
+
+void SeqViews::spill(const std::string& name) const {
+  View v;
+  if (!find(name, v)) return;
+  std::ofstream f(name, std::ios::binary);
+  f.write(v.map->data() + v.beg, static_cast<std::streamsize>(v.size));
+}
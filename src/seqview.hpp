@@ -0,0 +1,82 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_SEQVIEW_HPP
+#define SMASHPP_SEQVIEW_HPP
+
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace smashpp {
+// Segments of the sequences, as views (offset, size) of the file each comes
+// from, instead of files of their own. A file is mapped to memory once, while
+// it has views. A view goes by the name its file would have, e.g.,
+// "0.ref.tar.s3", so the rest of the code, and the positions file, name it as
+// before; a name with no view is that of a file. Can be used by many threads
+// at once.
+class SeqViews {
+ public:
+  void add(const std::string&, const std::string&, uint64_t,
+           uint64_t);  // Name, of (a view or a file), beg, size
+  void remove(const std::string&);
+  auto size(const std::string&) const -> uint64_t;  // Of a view or a file
+  auto open(const std::string&) const -> std::unique_ptr<std::istream>;
+  void spill(const std::string&) const;  // Write a view to its file
+
+ private:
+  class Map {  // Content of a file
+   public:
+    explicit Map(const std::string&);
+    ~Map();
+    Map(const Map&) = delete;
+    Map& operator=(const Map&) = delete;
+    auto data() const -> const char* { return ptr; }
+    auto size() const -> uint64_t { return n; }
+
+   private:
+    void* base;              // Mapped, if not null
+    std::vector<char> copy;  // Read, if it cannot be mapped
+    const char* ptr;
+    uint64_t n;
+  };
+  struct View {
+    std::shared_ptr<const Map> map;
+    uint64_t beg;
+    uint64_t size;
+  };
+  class Buf : public std::streambuf {  // Reads a view, as ifstream a file
+   public:
+    explicit Buf(const View&);
+
+   protected:
+    auto seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode)
+        -> pos_type override;
+    auto seekpos(pos_type, std::ios_base::openmode) -> pos_type override;
+
+   private:
+    std::shared_ptr<const Map> map;  // Kept while read
+  };
+  class Stream : public std::istream {
+   public:
+    explicit Stream(const View& v) : std::istream(nullptr), buf(v) {
+      rdbuf(&buf);
+    }
+
+   private:
+    Buf buf;
+  };
+  mutable std::mutex mut;
+  std::map<std::string, View> views;
+  std::map<std::string, std::weak_ptr<const Map>> maps;  // By file name
+
+  auto find(const std::string&, View&) const -> bool;
+};
+}  // namespace smashpp
+
+#endif  // SMASHPP_SEQVIEW_HPP
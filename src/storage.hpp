@@ -0,0 +1,352 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_STORAGE_HPP
+#define SMASHPP_STORAGE_HPP
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "def.hpp"
+
+namespace smashpp {
+static constexpr uint64_t MMAP_MIN{1ull << 21};  // Bytes mapped, not new[]
+static constexpr uint64_t SPARSE_RATIO{16};  // Dense/sparse bytes, if sparse
+static constexpr uint8_t SPARSE_BITS{10};    // log2 initial no. groups
+static constexpr uint8_t DIRTY_BITS{12};     // log2 bytes of a block flagged
+
+// Size of the pages reserved by the system for MAP_HUGETLB, 0 if unknown
+inline uint64_t huge_page_size() {
+  std::ifstream f("/proc/meminfo");
+  for (std::string key; f >> key;) {
+    uint64_t kb = 0;
+    if (key == "Hugepagesize:" && f >> kb) return kb << 10u;
+    f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+  return 0;
+}
+
+// Size of the transparent huge pages, 0 if the system never gives them
+inline uint64_t thp_page_size() {
+  std::ifstream enabled("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string modes;
+  if (!std::getline(enabled, modes) ||
+      modes.find("[never]") != std::string::npos)
+    return 0;
+  std::ifstream pmd("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+  uint64_t size = 0;
+  return (pmd >> size) ? size : 0;
+}
+
+// Contiguous array of counters. Either owned (zero-filled on allocation) or
+// mapped copy-on-write from a model file, so it never has to be rebuilt.
+// Large arrays are anonymous maps, zeroed lazily by the system as the pages
+// are touched, on huge pages if asked for (see Pages) and available. The
+// blocks of 2^DIRTY_BITS bytes written to are flagged, so that clear() zeroes
+// only those.
+//
+// An array of which only a few elements will ever be touched, e.g. the model
+// of a short segment, is sparse instead: groups of CARDIN elements (a row of
+// a table) are kept in a hash table, which grows with the groups touched.
+// Reading an untouched element gives 0, as in the array. The elements are
+// the same, so are the results of the models; but a sparse array has no
+// data(), it may only be accessed by one thread at a time, and a reference
+// to an element is valid until another group is touched.
+template <typename T>
+class Storage {
+ public:
+  Storage()
+      : ptr(nullptr), n(0), base(nullptr), len(0), page(0), anon(false),
+        nGroups(0), bits(0) {}
+  Storage(const Storage&) = delete;
+  Storage& operator=(const Storage&) = delete;
+  ~Storage() { release(); }
+
+  // Allocate, zero-filled. Sparse if the elements touched, if known (non-0),
+  // are few
+  void resize(uint64_t, Pages = Pages::transparent, uint64_t = 0);
+  bool map(const std::string&, uint64_t, uint64_t);  // Map from a file
+  void clear();  // Zero all elements, in place, keeping the memory
+  auto fits(uint64_t touched) const -> bool {  // Same as resize would make
+    return (base == nullptr || anon) && sparse_for(n, touched) == is_sparse();
+  }
+  static auto bytes_for(uint64_t, uint64_t) -> uint64_t;  // Size, touched
+  auto bytes() const -> uint64_t;  // Taken, as it is
+
+  auto operator[](uint64_t i) -> T& {  // To write to
+    if (!ptr) return sparse_at(i);
+    auto& flag = dirty[(i * sizeof(T)) >> DIRTY_BITS];  // Shared by threads,
+    if (__atomic_load_n(&flag, __ATOMIC_RELAXED) == 0)   // so stored once
+      __atomic_store_n(&flag, uint8_t{1}, __ATOMIC_RELAXED);
+    return ptr[i];
+  }
+  auto operator[](uint64_t i) const -> const T& {
+    return ptr ? ptr[i] : sparse_find(i);
+  }
+  auto data() -> T* { return ptr; }
+  auto data() const -> const T* { return ptr; }
+  auto size() const -> uint64_t { return n; }
+  auto begin() -> T* { return ptr; }  // Empty range, if sparse
+  auto end() -> T* { return ptr ? ptr + n : ptr; }
+  auto begin() const -> const T* { return ptr; }
+  auto end() const -> const T* { return ptr ? ptr + n : ptr; }
+  auto is_mapped() const -> bool { return base != nullptr; }
+  auto is_sparse() const -> bool { return !keys.empty(); }
+  auto page_size() const -> uint64_t { return page; }  // Bytes, as obtained
+  void prefetch(uint64_t i) const {  // Hint that element i is read soon
+#if defined(__GNUC__) || defined(__clang__)
+    if (ptr) __builtin_prefetch(ptr + i);
+#endif
+  }
+
+ private:
+  T* ptr;         // nullptr if sparse
+  uint64_t n;
+  void* base;     // Start of the mapped region, nullptr if by new[]
+  uint64_t len;   // Length of the mapped region
+  uint64_t page;  // Size of the pages
+  bool anon;      // Mapped region is anonymous, not from a file
+  std::vector<uint8_t> dirty;  // Not sparse: a block is written to, if 1
+  std::vector<uint64_t> keys;  // Sparse: group+1 in each slot, 0 if empty
+  std::vector<std::array<T, CARDIN>> groups;
+  uint64_t nGroups;  // No. groups touched
+  uint8_t bits;      // log2 no. slots
+
+  static auto sparse_for(uint64_t, uint64_t) -> bool;  // Size, touched
+  void dense_init(T*, uint64_t);  // Elements, size
+  void sparse_init();
+  auto slot(uint64_t) const -> uint64_t;  // Of a group, or the empty one
+  auto sparse_at(uint64_t) -> T&;
+  auto sparse_find(uint64_t) const -> const T&;
+  void grow();  // Double the slots
+  void release();
+};
+
+// Explicit huge pages are tried first, if asked for, then transparent ones,
+// which the system may or may not give, then normal pages. Throws
+// std::bad_alloc, like new[], if there is no memory.
+template <typename T>
+inline void Storage<T>::resize(uint64_t size, Pages pages, uint64_t touched) {
+  release();
+  if (sparse_for(size, touched)) {
+    n = size;
+    sparse_init();
+#ifndef _WIN32
+    page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+#endif
+    return;
+  }
+  const auto bytes = size * sizeof(T);
+#ifndef _WIN32
+  if (bytes >= MMAP_MIN) {
+    const auto anon_map = [&](uint64_t length, int flags) {
+      void* addr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+      if (addr == MAP_FAILED) return false;
+      base = addr;
+      len = length;
+      anon = true;
+      dense_init(static_cast<T*>(addr), size);
+      return true;
+    };
+#ifdef MAP_HUGETLB
+    const auto huge = huge_page_size();
+    if (pages == Pages::huge && huge != 0 &&
+        anon_map((bytes + huge - 1) / huge * huge, MAP_HUGETLB)) {
+      page = huge;
+      return;
+    }
+#endif
+    if (anon_map(bytes, 0)) {
+      page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+#ifdef MADV_HUGEPAGE
+      const auto thp = thp_page_size();
+      if (pages != Pages::normal && thp != 0 &&
+          ::madvise(base, len, MADV_HUGEPAGE) == 0)
+        page = thp;
+#endif
+      return;
+    }
+    throw std::bad_alloc();
+  }
+  page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+#endif
+  dense_init(new T[size](), size);  // May throw std::bad_alloc
+}
+
+// Map "size" elements of "name", starting at byte "offset". Falls back to
+// reading the file when mapping is not possible.
+template <typename T>
+inline bool Storage<T>::map(const std::string& name, uint64_t offset,
+                            uint64_t size) {
+  release();
+#ifndef _WIN32
+  const int fd = ::open(name.c_str(), O_RDONLY);
+  if (fd == -1) return false;
+  const auto page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+  const auto aligned = offset & ~(page - 1);  // mmap offset must be aligned
+  const auto bytes = size * sizeof(T) + (offset - aligned);
+  void* addr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                      static_cast<off_t>(aligned));
+  ::close(fd);
+  if (addr != MAP_FAILED) {
+    base = addr;
+    len = bytes;
+    this->page = page;
+    dense_init(
+        reinterpret_cast<T*>(static_cast<char*>(addr) + (offset - aligned)),
+        size);
+    return true;
+  }
+#endif
+  std::ifstream f(name, std::ios::binary);
+  if (!f) return false;
+  resize(size);
+  f.seekg(static_cast<std::streamoff>(offset));
+  f.read(reinterpret_cast<char*>(ptr),
+         static_cast<std::streamsize>(size * sizeof(T)));
+  return f.gcount() == static_cast<std::streamsize>(size * sizeof(T));
+}
+
+// Only the blocks written to, or the groups of a sparse array, are zeroed.
+// The pages stay with the array, so whoever reuses it takes no page faults
+template <typename T>
+inline void Storage<T>::clear() {
+  if (is_sparse()) {
+    for (size_t s = 0; s != keys.size(); ++s)
+      if (keys[s] != 0) {
+        keys[s] = 0;
+        groups[s] = {};
+      }
+    nGroups = 0;
+    return;
+  }
+  const auto block{(1ull << DIRTY_BITS) / sizeof(T)};  // Elements
+  for (uint64_t b = 0; b != dirty.size(); ++b)
+    if (dirty[b] != 0) {
+      const auto end{std::min<uint64_t>(n, (b + 1) * block)};
+      std::fill(ptr + b * block, ptr + end, T{});
+      dirty[b] = 0;
+    }
+}
+
+// At most 1 group per element touched, in 1/4 to 1/2 of the slots
+template <typename T>
+inline bool Storage<T>::sparse_for(uint64_t size, uint64_t touched) {
+  const auto slotBytes = sizeof(uint64_t) + sizeof(std::array<T, CARDIN>);
+  return touched != 0 && touched * slotBytes * SPARSE_RATIO < size * sizeof(T);
+}
+
+// Bytes that resize would take, at most, as the sparse array grows
+template <typename T>
+inline uint64_t Storage<T>::bytes_for(uint64_t size, uint64_t touched) {
+  if (!sparse_for(size, touched)) return size * sizeof(T);
+  const auto slotBytes = sizeof(uint64_t) + sizeof(std::array<T, CARDIN>);
+  auto slots = 1ull << SPARSE_BITS;
+  while (slots < 2 * touched) slots <<= 1u;
+  return slots * slotBytes;
+}
+
+template <typename T>
+inline uint64_t Storage<T>::bytes() const {
+  return ptr ? n * sizeof(T) + dirty.size()
+             : keys.size() * sizeof(uint64_t) +
+                   groups.size() * sizeof(std::array<T, CARDIN>);
+}
+
+template <typename T>
+inline void Storage<T>::dense_init(T* elems, uint64_t size) {
+  static_assert((1ull << DIRTY_BITS) % sizeof(T) == 0, "blocks of elements");
+  ptr = elems;
+  n = size;
+  dirty.assign(((size * sizeof(T)) >> DIRTY_BITS) + 1, 0);
+}
+
+template <typename T>
+inline void Storage<T>::sparse_init() {
+  bits = SPARSE_BITS;
+  std::vector<uint64_t>(1ull << bits, 0).swap(keys);
+  std::vector<std::array<T, CARDIN>>(1ull << bits).swap(groups);
+  nGroups = 0;
+}
+
+// Fibonacci hashing, then linear probing
+template <typename T>
+inline uint64_t Storage<T>::slot(uint64_t group) const {
+  const auto mask = (1ull << bits) - 1;
+  auto i = (group * 0x9E3779B97F4A7C15ull) >> (64u - bits);
+  while (keys[i] != 0 && keys[i] != group + 1) i = (i + 1) & mask;
+  return i;
+}
+
+template <typename T>
+inline T& Storage<T>::sparse_at(uint64_t i) {
+  auto s = slot(i / CARDIN);
+  if (keys[s] == 0) {
+    if (2 * (nGroups + 1) > keys.size()) {  // Load factor <= 1/2
+      grow();
+      s = slot(i / CARDIN);
+    }
+    keys[s] = i / CARDIN + 1;
+    ++nGroups;
+  }
+  return groups[s][i % CARDIN];
+}
+
+template <typename T>
+inline const T& Storage<T>::sparse_find(uint64_t i) const {
+  static const std::array<T, CARDIN> zeros{};  // Untouched group
+  const auto s = slot(i / CARDIN);
+  return (keys[s] == 0) ? zeros[i % CARDIN] : groups[s][i % CARDIN];
+}
+
+template <typename T>
+inline void Storage<T>::grow() {
+  std::vector<uint64_t> oldKeys(1ull << ++bits, 0);
+  std::vector<std::array<T, CARDIN>> oldGroups(1ull << bits);
+  keys.swap(oldKeys);
+  groups.swap(oldGroups);
+  for (size_t j = 0; j != oldKeys.size(); ++j)
+    if (oldKeys[j] != 0) {
+      const auto s = slot(oldKeys[j] - 1);
+      keys[s] = oldKeys[j];
+      groups[s] = oldGroups[j];
+    }
+}
+
+template <typename T>
+inline void Storage<T>::release() {
+#ifndef _WIN32
+  if (base) {
+    ::munmap(base, len);
+    base = nullptr;
+    len = 0;
+    anon = false;
+    ptr = nullptr;
+  }
+#endif
+  delete[] ptr;
+  ptr = nullptr;
+  n = 0;
+  page = 0;
+  std::vector<uint64_t>().swap(keys);
+  std::vector<std::array<T, CARDIN>>().swap(groups);
+  std::vector<uint8_t>().swap(dirty);
+  nGroups = 0;
+  bits = 0;
+}
+}  // namespace smashpp
+
+#endif  // SMASHPP_STORAGE_HPP
\ No newline at end of file
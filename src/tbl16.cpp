@@ -0,0 +1,75 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#include "tbl16.hpp"
+
+#include <fstream>
+#include <array>
+
+#include "exception.hpp"
+using namespace smashpp;
+
+Table16::Table16(uint8_t k_, Pages pages, uint64_t touched) : k(k_) {
+  try {  // 1<<2k = 4^k rows
+    tbl.resize(1ull << (k << 1u), pages, touched);
+  } catch (std::bad_alloc& b) {
+    error("failed memory allocation.");
+  }
+}
+
+Table16::Table16(uint8_t k_, const std::string& name, uint64_t offset)
+    : k(k_) {
+  if (!tbl.map(name, offset, 1ull << (k << 1u)))
+    error("failed loading model \"" + name + "\".");
+}
+
+void Table16::update(Table16::ctx_t ctx) {
+  auto& row = tbl[ctx >> 2u];
+  const auto shift{(ctx & 3u) << 4u};
+  if (((row >> shift) & 0xFFFFu) == 0xFFFFu)  // Halve all 4
+    row = (row >> 1u) & 0x7FFF7FFF7FFF7FFFull;
+  row += 1ull << shift;
+}
+
+// A row is only updated by the thread of its range, so halving is the same
+void Table16::update(Table16::ctx_t ctx, uint64_t) { update(ctx); }
+
+auto Table16::query(Table16::ctx_t ctx) const -> Table16::val_t {
+  return static_cast<val_t>(tbl[ctx >> 2u] >> ((ctx & 3u) << 4u));
+}
+
+auto Table16::query_counters(Table16::ctx_t l) const
+    -> std::array<Table16::val_t, CARDIN> {
+  const auto row{tbl[l >> 2u]};
+  return {static_cast<val_t>(row), static_cast<val_t>(row >> 16u),
+          static_cast<val_t>(row >> 32u), static_cast<val_t>(row >> 48u)};
+}
+
+void Table16::prefetch(Table16::ctx_t ctx) const { tbl.prefetch(ctx >> 2u); }
+
+auto Table16::page_size() const -> uint64_t { return tbl.page_size(); }
+
+auto Table16::is_sparse() const -> bool { return tbl.is_sparse(); }
+
+auto Table16::held() const -> uint64_t { return tbl.bytes(); }
+
+void Table16::clear() { tbl.clear(); }
+
+void Table16::fit(Pages pages, uint64_t touched) {
+  if (tbl.fits(touched)) return;
+  try {
+    tbl.resize(tbl.size(), pages, touched);
+  } catch (std::bad_alloc& b) {
+    error("failed memory allocation.");
+  }
+}
+
+auto Table16::bytes(uint8_t k, uint64_t touched) -> uint64_t {
+  return Storage<uint64_t>::bytes_for(1ull << (k << 1u), touched);
+}
+
+void Table16::dump(std::ofstream& ofs) const {
+  ofs.write(reinterpret_cast<const char*>(tbl.data()),
+            static_cast<std::streamsize>(tbl.size() * sizeof(uint64_t)));
+}
@@ -0,0 +1,42 @@
+// Smash++
+// Morteza Hosseini    seyedmorteza@ua.pt
+// Copyright (C) 2018-2020, IEETA, University of Aveiro, Portugal.
+
+#ifndef SMASHPP_TABLE16_HPP
+#define SMASHPP_TABLE16_HPP
+
+#include "def.hpp"
+#include "storage.hpp"
+
+namespace smashpp {
+// The 4 counters of a row -- context, no symbol -- packed in a word, the
+// counter of symbol s at bits [16s, 16s+16). All 4 are halved when one would
+// overflow. A query reads one word; 8 bytes a row, where Table64 takes 32
+class Table16 {
+  using ctx_t = uint32_t;
+  using val_t = uint16_t;
+
+ private:
+  Storage<uint64_t> tbl;  // Table of rows of 4 16 bit counters
+  uint8_t k;              // Ctx size
+
+ public:
+  Table16() : k(0) {}
+  explicit Table16(uint8_t, Pages = Pages::transparent, uint64_t = 0);
+  Table16(uint8_t, const std::string&, uint64_t);  // Map from model file
+  void update(ctx_t);                // Update table
+  void update(ctx_t, uint64_t);      // Update, by one thread per row range
+  auto query(ctx_t) const -> val_t;  // Query count of ctx
+  auto query_counters(ctx_t) const -> std::array<val_t, CARDIN>;
+  void prefetch(ctx_t) const;  // Hint that a row is read soon
+  auto page_size() const -> uint64_t;  // Pages of the table (bytes)
+  auto is_sparse() const -> bool;      // See Storage
+  void clear();                        // Zero the counters, for reuse
+  auto held() const -> uint64_t;       // Bytes taken, as it is
+  void fit(Pages, uint64_t);  // Sparse or not as if new, for n touched
+  static auto bytes(uint8_t, uint64_t) -> uint64_t;  // If new, k, touched
+  void dump(std::ofstream&) const;   // Write rows into model file
+};
+}  // namespace smashpp
+
+#endif  // SMASHPP_TABLE16_HPP
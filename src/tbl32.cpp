@@ -11,14 +11,21 @@
 #include "exception.hpp"
 using namespace smashpp;
 
-Table32::Table32(uint8_t k_) : k(k_), nRenorm(0), tot(0) {
+Table32::Table32(uint8_t k_, Pages pages, uint64_t touched)
+    : k(k_), nRenorm(0), tot(0) {
   try {  // 4<<2k = 4*2^2k = 4*4^k = 4^(k+1)
-    tbl.resize(4ull << (k << 1u));
+    tbl.resize(4ull << (k << 1u), pages, touched);
   } catch (std::bad_alloc& b) {
     error("failed memory allocation.");
   }
 }
 
+Table32::Table32(uint8_t k_, const std::string& name, uint64_t offset)
+    : k(k_), nRenorm(0), tot(0) {
+  if (!tbl.map(name, offset, 4ull << (k << 1u)))
+    error("failed loading model \"" + name + "\".");
+}
+
 void Table32::update(Table32::ctx_t ctx) {
   if (tbl[ctx] == 0xFFFFFFFF)  // 2^32-1
     renormalize();
@@ -26,6 +33,10 @@ void Table32::update(Table32::ctx_t ctx) {
   ++tot;
 }
 
+// Same count as update(ctx_t), since renormalize() leaves the table as is.
+// The totals are not kept, as they would be shared by all threads.
+void Table32::update(Table32::ctx_t ctx, uint64_t) { ++tbl[ctx]; }
+
 inline void Table32::renormalize() {
   for (auto c : tbl) c >>= 1;
   ++nRenorm;
@@ -42,16 +53,40 @@ auto Table32::query_counters(Table32::ctx_t l) const
           *(row_address + 3)};
 }
 
-#ifdef DEBUG
-void Table32::dump(std::ofstream& ofs) const {
-  ofs.write((const char*)&tbl[0], tbl.size());
-  //  ofs.close();
+void Table32::prefetch(Table32::ctx_t ctx) const { tbl.prefetch(ctx); }
+
+auto Table32::page_size() const -> uint64_t { return tbl.page_size(); }
+
+auto Table32::is_sparse() const -> bool { return tbl.is_sparse(); }
+
+auto Table32::held() const -> uint64_t { return tbl.bytes(); }
+
+void Table32::clear() {
+  tbl.clear();
+  nRenorm = 0;
+  tot = 0;
 }
 
-void Table32::load(std::ifstream& ifs) const {
-  ifs.read((char*)&tbl[0], tbl.size());
+void Table32::fit(Pages pages, uint64_t touched) {
+  if (tbl.fits(touched)) return;
+  try {
+    tbl.resize(tbl.size(), pages, touched);
+  } catch (std::bad_alloc& b) {
+    error("failed memory allocation.");
+  }
 }
 
+auto Table32::bytes(uint8_t k, uint64_t touched) -> uint64_t {
+  return Storage<uint32_t>::bytes_for(4ull << (k << 1u), touched);
+}
+
+void Table32::dump(std::ofstream& ofs) const {
+  ofs.write(reinterpret_cast<const char*>(tbl.data()),
+            static_cast<std::streamsize>(tbl.size() * sizeof(uint32_t)));
+}
+
+#ifdef DEBUG
+
 uint64_t Table32::get_total() const { return tot; }
 
 uint64_t Table32::count_empty() const {
@@ -5,9 +5,8 @@
 #ifndef SMASHPP_TABLE32_HPP
 #define SMASHPP_TABLE32_HPP
 
-#include <vector>
-
 #include "def.hpp"
+#include "storage.hpp"
 
 namespace smashpp {
 class Table32 {
@@ -15,21 +14,29 @@ class Table32 {
   using val_t = uint32_t;
 
  private:
-  std::vector<uint32_t> tbl;  // Table of 32 bit counters
-  uint8_t k;                  // Ctx size
-  uint32_t nRenorm;           // Renormalization times
-  uint64_t tot;               // Total # elements so far
+  Storage<uint32_t> tbl;  // Table of 32 bit counters
+  uint8_t k;              // Ctx size
+  uint32_t nRenorm;       // Renormalization times
+  uint64_t tot;           // Total # elements so far
 
  public:
   Table32() : k(0), nRenorm(0), tot(0) {}
-  explicit Table32(uint8_t);
+  explicit Table32(uint8_t, Pages = Pages::transparent, uint64_t = 0);
+  Table32(uint8_t, const std::string&, uint64_t);  // Map from model file
   void update(ctx_t);                // Update table
+  void update(ctx_t, uint64_t);      // Update, by one thread per row range
   auto query(ctx_t) const -> val_t;  // Query count of ctx
   auto query_counters(ctx_t) const -> std::array<val_t, CARDIN>;
+  void prefetch(ctx_t) const;  // Hint that a row is read soon
+  auto page_size() const -> uint64_t;  // Pages of the table (bytes)
+  auto is_sparse() const -> bool;      // See Storage
+  void clear();                        // Zero the counters, for reuse
+  auto held() const -> uint64_t;       // Bytes taken, as it is
+  void fit(Pages, uint64_t);  // Sparse or not as if new, for n touched
+  static auto bytes(uint8_t, uint64_t) -> uint64_t;  // If new, k, touched
+  void dump(std::ofstream&) const;   // Write counters into model file
 
 #ifdef DEBUG
-  void dump(std::ofstream&) const;
-  void load(std::ifstream&) const;
   auto get_total() const -> uint64_t;  // Total count of all items in the table
   auto count_empty() const -> uint64_t;  // Number of empty cells in the table
   auto max_tbl_val() const -> uint32_t;
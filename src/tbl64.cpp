@@ -11,16 +11,25 @@
 #include "exception.hpp"
 using namespace smashpp;
 
-Table64::Table64(uint8_t k_) : k(k_) {
+Table64::Table64(uint8_t k_, Pages pages, uint64_t touched)
+    : k(k_) {
   try {  // 4<<2k = 4*2^2k = 4*4^k = 4^(k+1)
-    tbl.resize(4ull << (k << 1u));
+    tbl.resize(4ull << (k << 1u), pages, touched);
   } catch (std::bad_alloc& b) {
     error("failed memory allocation.");
   }
 }
 
+Table64::Table64(uint8_t k_, const std::string& name, uint64_t offset)
+    : k(k_) {
+  if (!tbl.map(name, offset, 4ull << (k << 1u)))
+    error("failed loading model \"" + name + "\".");
+}
+
 void Table64::update(Table64::ctx_t ctx) { ++tbl[ctx]; }
 
+void Table64::update(Table64::ctx_t ctx, uint64_t) { ++tbl[ctx]; }
+
 auto Table64::query(Table64::ctx_t ctx) const -> Table64::val_t {
   return tbl[ctx];
 }
@@ -32,16 +41,38 @@ auto Table64::query_counters(Table64::ctx_t l) const
           *(row_address + 3)};
 }
 
-#ifdef DEBUG
-void Table64::dump(std::ofstream& ofs) const {
-  ofs.write((const char*)&tbl[0], tbl.size());
-  //  ofs.close();
+void Table64::prefetch(Table64::ctx_t ctx) const { tbl.prefetch(ctx); }
+
+auto Table64::page_size() const -> uint64_t { return tbl.page_size(); }
+
+auto Table64::is_sparse() const -> bool { return tbl.is_sparse(); }
+
+auto Table64::held() const -> uint64_t { return tbl.bytes(); }
+
+void Table64::clear() {
+  tbl.clear();
 }
 
-void Table64::load(std::ifstream& ifs) const {
-  ifs.read((char*)&tbl[0], tbl.size());
+void Table64::fit(Pages pages, uint64_t touched) {
+  if (tbl.fits(touched)) return;
+  try {
+    tbl.resize(tbl.size(), pages, touched);
+  } catch (std::bad_alloc& b) {
+    error("failed memory allocation.");
+  }
 }
 
+auto Table64::bytes(uint8_t k, uint64_t touched) -> uint64_t {
+  return Storage<uint64_t>::bytes_for(4ull << (k << 1u), touched);
+}
+
+void Table64::dump(std::ofstream& ofs) const {
+  ofs.write(reinterpret_cast<const char*>(tbl.data()),
+            static_cast<std::streamsize>(tbl.size() * sizeof(uint64_t)));
+}
+
+#ifdef DEBUG
+
 uint64_t Table64::count_empty() const {
   return static_cast<uint64_t>(std::count(std::begin(tbl), std::end(tbl), 0));
 }